@@ -0,0 +1,75 @@
+#ifdef CHECKED
+
+#ifndef _BOUNDS_H_
+#define _BOUNDS_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#endif
+
+// Checked builds verify every array index. The pass below proves what it
+// can from the value ranges of the linear index `Expr`s:
+// - In bounds for every value the operands can take: no check at all
+// - Affine in the variable of the enclosing `hor`, with the rest invariant:
+//   both ends of the range are checked once before the loop, so such a loop
+//   fails before its first iteration rather than at the bad one
+// - Anything else: checked on each access
+
+typedef struct Range {
+  long long lo;
+  long long hi;
+  char known;
+} Range;
+
+typedef struct Bounds {
+  DynArr *stmts;     // Stmt *
+  DynArr *var_decls; // VarDecl *
+  DynArr ranges;     // Range, per decl, for the scope being visited
+  struct BoundsStats {
+    usize accesses;
+    usize proven;  // Check removed
+    usize hoisted; // Check moved before a `hor`
+    usize hoists;  // Preheader checks those became
+    usize checked; // Check left on the access
+    usize bulk;    // Bulk loops, checked once per run
+  } stats;
+} Bounds;
+
+void bounds_init(Bounds *bounds, DynArr *stmts, DynArr *var_decls);
+Bounds *bounds_create(DynArr *stmts, DynArr *var_decls);
+void bounds_free(Bounds *bounds);
+void bounds_run(Bounds *bounds);
+void bounds_stats(Bounds *bounds);
+
+// Runtime side, shared by both engines
+void bounds_fail(VarDecl *decl, long long idx);
+
+static inline void bounds_check(VarDecl *decl, long long idx) {
+  if (idx < decl->start || idx > decl->end) {
+    bounds_fail(decl, idx);
+  }
+}
+
+// `[first, first+cnts)`, `cnts` > 0
+static inline void bounds_check_range(VarDecl *decl, int first, usize cnts) {
+  bounds_check(decl, first);
+  bounds_check(decl, (long long)first + cnts - 1);
+}
+
+// `coefficient*var + rest` for `var` in `[start, end]`, `start` <= `end`
+static inline void bounds_check_hoist(VarDecl *decl, int coefficient,
+                                      int start, int end, int rest) {
+  bounds_check(decl, (long long)coefficient * start + rest);
+  bounds_check(decl, (long long)coefficient * end + rest);
+}
+
+#endif // _BOUNDS_H_
+
+#endif
@@ -0,0 +1,41 @@
+#ifdef RESULT_CACHE
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stdint.h>
+#endif
+
+// Programs read no input, so the output only depends on the program itself.
+// Results are stored per canonical AST hash in `CYR_CACHE_DIR`.
+#define CACHE_DEFAULT_DIR ".cyr_cache"
+#define CACHE_DEFAULT_MAX_BYTES (16u << 20) // `CYR_CACHE_MAX_BYTES`
+#define CACHE_MAX_ENTRY_BYTES (1u << 20)    // Larger outputs are not stored
+#define CACHE_PATH_MAX 512
+
+typedef struct ResultCache {
+  uint64_t key;
+  const char *dir;
+  usize max_bytes;
+  char path[CACHE_PATH_MAX];
+  DynArr output; // char, captured `yosoro` stream
+} ResultCache;
+
+uint64_t cache_hash_program(DynArr *stmts, DynArr *var_decls);
+void cache_init(ResultCache *cache, uint64_t key);
+void cache_free(ResultCache *cache);
+int cache_replay(ResultCache *cache, int *status);
+void cache_begin(ResultCache *cache);
+void cache_store(ResultCache *cache, int status);
+
+#endif // _CACHE_H_
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef CODEGEN
+#ifdef CLOSURE
+
+#ifndef _CLOSURE_H_
+#define _CLOSURE_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "interpreter.h"
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#endif
+
+// Every AST node is compiled into a node/function pair chosen by its shape,
+// with its operands bound to `int *` once.
+
+typedef struct CExpr CExpr;
+typedef int (*CExprFn)(const CExpr *expr);
+
+typedef struct CTerm {
+  int coefficient;
+  int *ref; // Int var, or NULL
+  union {   // Array data biased by `-start`
+    int *base;
+    short *base16;
+    signed char *base8;
+  };
+  enum ElemWidth width;
+  CExpr *idx; // Array index
+} CTerm;
+
+struct CExpr {
+  CExprFn fn;
+  int constant;
+  int *a; // Bound int operands of the small shapes
+  int *b;
+  int coef_a;
+  int coef_b;
+  CTerm *terms;
+  usize term_cnts;
+};
+
+typedef struct CCond CCond;
+typedef char (*CCondFn)(const CCond *cond);
+
+struct CCond {
+  CCondFn fn;
+  cmp_type typ;
+  CExpr left;
+  CExpr right;
+};
+
+typedef struct CStmt CStmt;
+typedef void (*CStmtFn)(const CStmt *stmt);
+
+typedef struct CBlock {
+  CStmt *stmts;
+  usize cnts;
+} CBlock;
+
+struct CStmt {
+  CStmtFn fn;
+  union CStmtInner {
+    struct CSetStmt {
+      CTerm dst;
+      CExpr val;
+    } set;
+    struct CCondStmt { // ihu, while
+      CCond cond;
+      CBlock body;
+    } cond_blk;
+    struct CHorStmt {
+      CTerm var;
+      CExpr start;
+      CExpr end;
+      CBlock body;
+    } hor;
+    CExpr yosoro;
+    struct CFallbackStmt { // Rare shapes run on the tree-walker
+      Interpreter *interpreter;
+      Stmt *stmt;
+    } fallback;
+  } inner;
+};
+
+typedef struct Closure {
+  DynArr *stmts;     // Stmt *
+  DynArr *var_decls; // VarDecl *
+  DynArr allocs;     // void *, owned by the compiled tree
+  CBlock root;
+  Interpreter interpreter;
+#ifndef NO_DEBUG
+  struct ClosureStats {
+    usize stmts;
+    usize exprs;
+    usize specialized;
+    usize fallback;
+  } stats;
+#endif
+} Closure;
+
+void closure_init(Closure *closure, DynArr *stmts, DynArr *var_decls);
+Closure *closure_create(DynArr *stmts, DynArr *var_decls);
+void closure_free(Closure *closure);
+void closure_compile(Closure *closure);
+void closure_execute(Closure *closure);
+#ifndef NO_DEBUG
+void closure_stats(Closure *closure);
+#endif
+
+#endif // _CLOSURE_H_
+
+#endif
+#endif
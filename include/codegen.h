@@ -15,36 +15,46 @@ enum OpCodeType {
 #undef OPCODE
 };
 
-typedef struct CondJmp {
-  cmp_type cmp_typ;
-  short offset;
-} __attribute__((packed)) CondJmp;
+// Fixed-width and aligned, variables are named by their decl index.
+//   slot: the decl, the `cmp_type` of CJMP, the table size of SWITCH
+//   imm:  constants, jump offsets, the low key of SWITCH
+// The stack delta is implied by `typ`.
+typedef struct OpCode {
+  unsigned typ : 8; // enum OpCodeType
+  unsigned slot : 24;
+  int imm;
+} OpCode;
 
-typedef struct VarConst {
-  VarDecl *ptr;
-  // unsigned short decl_idx;
-  int constant;
-} __attribute__((packed)) VarConst;
+_Static_assert(sizeof(OpCode) == 8, "OpCode should stay 8 bytes");
 
-typedef struct OpCode {
-  enum OpCodeType typ : 8;
-  int stack_delta;
-  union OpCodeData {
-    short offset;
-    int constant;
-    // int term_cnts;
-    VarDecl *ptr;
-    // unsigned short decl_idx;
-    CondJmp cjmp;
-    VarConst var_const;
-    // cmp_type cmp_typ;
-  } __attribute__((packed)) data;
-} __attribute__((packed)) OpCode;
+// Slot of CJMP_VI/VV/AI, decls fit in 16 bits as `Operand.decl_idx` does
+#define CJMP_SLOT(decl, cmp) ((decl) | (cmp) << 16)
+#define CJMP_SLOT_DECL(slot) ((slot) & 0xffff)
+#define CJMP_SLOT_CMP(slot) ((slot) >> 16)
+
+// Runs of at least SWITCH_MIN_CASES sibling `{ ihu eq, x, K }` blocks
+// dispatch on `x` once: through a jump table when at least half of
+// `[min K, max K]` are cases, through a binary decision tree otherwise.
+#define SWITCH_MIN_CASES 3
+#define SWITCH_MAX_TAB 1024
+#define SWITCH_LEAF_CASES 3 // Tree leaves test this many keys in turn
+
+// Int terms of a LINCOMB, a run starts with a head holding its length
+typedef struct LinTerm {
+  unsigned decl; // The term count in the head
+  int coef;
+} LinTerm;
+
+// Expressions with at least this many int terms are a single LINCOMB
+#define LINCOMB_MIN_TERMS 2
 
 typedef struct CodeGen {
   DynArr codes;
+  DynArr lin_terms; // LinTerm, runs of the LINCOMBs
   DynArr *stmts;
   DynArr *var_decls;
+  int max_depth;     // Of the operand stack, along every path
+  DynArr stmt_starts; // usize, code index of each statement and block end
 } CodeGen;
 
 void cg_init(CodeGen *cg, DynArr *stmts, DynArr *var_decls);
@@ -1,4 +1,4 @@
-#ifndef CODEGEN
+#if !defined(CODEGEN) || defined(PROFILE)
 
 #ifndef _INTERPRETER_H_
 #define _INTERPRETER_H_
@@ -6,17 +6,63 @@
 #pragma once
 
 #ifndef NO_CUSTOM_INC
+#include "parser.h"
 #include "utils.h"
 #endif
 
+#ifdef PROFILE
+#ifndef NO_CUSTOM_INC
+#include "profiler.h"
+#endif
+#endif
+
 #ifndef NO_STD_INC
 #include <stddef.h>
 #endif
 
+// Statements are run from one pre-order array, blocks become offsets
+enum FlatTyp {
+  FLAT_IHU,          // jmp: past the block
+  FLAT_WHILE,        // jmp: past the block
+  FLAT_WHILE_END,    // jmp: the header
+  FLAT_HOR,          // jmp: past the block
+  FLAT_HOR_NEXT,     // jmp: the header
+  FLAT_HOR_INT,      // Int var the body uses, stored every pass
+  FLAT_HOR_INT_NEXT, // jmp: the header
+  FLAT_HOR_REG,      // Int var the body never touches, stored on exit
+  FLAT_HOR_REG_NEXT, // jmp: the header
+  FLAT_YOSORO,
+  FLAT_SET,
+  FLAT_BULK,
+};
+
+static inline int flat_is_loop_end(enum FlatTyp typ) {
+  return typ == FLAT_WHILE_END || typ == FLAT_HOR_NEXT ||
+         typ == FLAT_HOR_INT_NEXT || typ == FLAT_HOR_REG_NEXT;
+}
+
+typedef struct FlatStmt {
+  enum FlatTyp typ;
+  usize jmp;
+  Stmt *stmt;
+} FlatStmt;
+
+// The innermost frame is kept in a local of `interpreter_execute`
+typedef struct HorFrame {
+  int i;
+  unsigned left; // Iterations after the current one
+  int *ref;      // Int loop variable
+} HorFrame;
+
 typedef struct Interpreter {
   DynArr *stmts; // Stmt *
   // usize exec_ptr;
   DynArr *var_decls; // VarDecl<VarData> *
+  DynArr flats;      // FlatStmt
+  DynArr frames;     // HorFrame, spilled frames of the enclosing `hor`s
+#ifdef PROFILE
+  Profiler profiler;
+#endif
 #ifndef NO_DEBUG
   struct InterpreterStats {
     usize operand_read;
@@ -31,9 +77,13 @@ void interpreter_init(Interpreter *interpreter, DynArr *stmts,
 Interpreter *interpreter_create(DynArr *stmts, DynArr *var_decls);
 void interpreter_free(Interpreter *interpreter);
 void interpreter_execute(Interpreter *interpreter);
+void execute_stmt(Interpreter *interpreter, Stmt *stmt);
 #ifndef NO_DEBUG
 void interpreter_stats(Interpreter *interpreter);
 #endif
+#ifdef PROFILE
+void interpreter_profile(Interpreter *interpreter, const char *src);
+#endif
 
 #endif // _INTERPRETER_H_
 
@@ -0,0 +1,22 @@
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "utils.h"
+#endif
+
+// Bulk array kernels for loops recognized by the optimizer,
+// shared by both engines.
+void bulk_fill(int *dst, usize cnts, int val);
+void bulk_iota(int *dst, usize cnts, int first, int stride);
+void bulk_copy(int *dst, const int *src, usize cnts, int addend);
+// Wrapping sums, vectorized with AVX2 when the CPU has it, SSE2 otherwise
+int bulk_sum(const int *src, usize cnts);
+// Wrapping `sum(coefs[i] * *refs[i])`, 8 terms per AVX2 step
+int linear_sum(const int *coefs, const int *const *refs, usize cnts);
+// `stride*var + val` summed over `var` in `[first, first+cnts)`
+int bulk_series_sum(int first, usize cnts, int stride, int val);
+
+#endif // _KERNELS_H_
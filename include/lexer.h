@@ -21,12 +21,14 @@ enum TokType {
 typedef struct Token {
   enum TokType type;
   const char *str;
+  usize line; // 1-based
 } Token;
 
 typedef struct Lexer {
   char *src;
   usize src_len;
   usize ch_pos;
+  usize line;
   DynArr toks; // Always store Token(s)
   StrPool tok_val_pool;
 } Lexer;
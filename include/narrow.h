@@ -0,0 +1,56 @@
+#ifndef _NARROW_H_
+#define _NARROW_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#endif
+
+// Arrays start zeroed and only change through writes of linear `Expr`s, so
+// joining the range of every value written to a decl, until nothing grows,
+// bounds everything it ever holds. Bounds still growing after
+// NARROW_WIDEN_ROUNDS rounds are widened to the whole `int` range.
+// Arrays whose range fits are stored in 8 or 16 bits, except those the bulk
+// kernels touch, which work on `int` elements.
+#define NARROW_WIDEN_ROUNDS 4
+
+typedef struct ValRange {
+  long long lo;
+  long long hi;
+} ValRange;
+
+typedef struct Narrow {
+  DynArr *stmts;     // Stmt *
+  DynArr *var_decls; // VarDecl *
+  DynArr ranges;     // ValRange, per decl
+  DynArr pinned;     // char, per decl: kept `int`
+  usize rounds;
+  char changed;
+#ifndef NO_DEBUG
+  struct NarrowStats {
+    usize arrs;
+    usize narrowed8;
+    usize narrowed16;
+    usize saved_bytes;
+  } stats;
+#endif
+} Narrow;
+
+void narrow_init(Narrow *narrow, DynArr *stmts, DynArr *var_decls);
+Narrow *narrow_create(DynArr *stmts, DynArr *var_decls);
+void narrow_free(Narrow *narrow);
+void narrow_run(Narrow *narrow);
+// The ranges alone, also used by the parallel scheduler
+void narrow_analyze(Narrow *narrow);
+ValRange narrow_range(Narrow *narrow, unsigned short decl_idx);
+#ifndef NO_DEBUG
+void narrow_stats(Narrow *narrow);
+#endif
+
+#endif // _NARROW_H_
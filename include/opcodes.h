@@ -1,6 +1,8 @@
 // OPCODE(arg)[arg0,arg1]
 // `arg` is on TEXT, `arg0` is on STACK(0), `arg1` is on STACK(-1)
+// `decl` is an index into the var decls of the program
 // push(sth): push sth to STACK, but will be aligned to 32-bits.
+// STACK(0) itself lives in a register of the VM, deeper entries in memory.
 
 #ifndef OPCODE
 #define DEFAULT_DEF
@@ -9,37 +11,96 @@
 
 OPCODE(OP_LOAD_CONST) // LOAD_CONST(const: i32)
                       // -> push(const)
-OPCODE(OP_LOAD_INT)   // LOAD_INT(ptr: decl*)
-                      // -> push(*int_ref(ptr))
-OPCODE(OP_LOAD_ARR)   // LOAD_ARR(ptr: decl*)[idx: i32]
-                      // -> push(*arr_ref(ptr, pop(idx)))
-OPCODE(OP_STORE_INT)  // STORE_INT(ptr: decl*)[val: i32]
-                      // -> *int_ref(ptr) = pop(val)
-OPCODE(OP_STORE_ARR)  // STORE_ARR(ptr: decl*)[idx: i32, val: i32]
-                      // -> *arr_ref(ptr, pop(idx)) = pop(val)
-OPCODE(OP_SETI)       // SETI(ptr: decl*, const: i32)
-                      // -> *int_ref(ptr) = const
+OPCODE(OP_LOAD_INT)   // LOAD_INT(decl: u24)
+                      // -> push(*int_ref(decl))
+OPCODE(OP_LOAD_ARR)   // LOAD_ARR(decl: u24)[idx: i32]
+                      // -> push(*arr_ref(decl, pop(idx)))
+OPCODE(OP_STORE_INT)  // STORE_INT(decl: u24)[val: i32]
+                      // -> *int_ref(decl) = pop(val)
+OPCODE(OP_STORE_ARR)  // STORE_ARR(decl: u24)[idx: i32, val: i32]
+                      // -> *arr_ref(decl, pop(idx)) = pop(val)
+OPCODE(OP_SETI)       // SETI(decl: u24, const: i32)
+                      // -> *int_ref(decl) = const
+// Arrays narrowed to 16 or 8 bits, same operands as LOAD_ARR and STORE_ARR
+OPCODE(OP_LOAD_ARR16)
+OPCODE(OP_LOAD_ARR8)
+OPCODE(OP_STORE_ARR16)
+OPCODE(OP_STORE_ARR8)
+// Pushes onto an empty stack, the same operands as LOAD_CONST and LOAD_INT.
+// Picked by `cg_gen`, they have no cached top to spill first.
+OPCODE(OP_LOAD_CONST_E)
+OPCODE(OP_LOAD_INT_E)
 
 OPCODE(OP_INCR) // INCR(const: i32)[num: i32]
                 // -> push(pop(num)+const)
-OPCODE(OP_INCI) // INCI(ptr: decl*, const: i32)
-                // -> *int_ref(ptr) += const
-// The below one is hard to impl ..
-// OPCODE(OP_INCA)    // INCA(ptr: decl*, const: i32)[idx: i32]
-//                    // -> *arr_ref(ptr, pop(idx)) += const
+OPCODE(OP_INCI) // INCI(decl: u24, const: i32)
+                // -> *int_ref(decl) += const
+// In-place element updates, the index is computed once. Narrowed arrays
+// are updated at their own width.
+OPCODE(OP_INCA) // INCA(decl: u24, const: i32)[idx: i32]
+                // -> *arr_ref(decl, pop(idx)) += const
+OPCODE(OP_ADDA) // ADDA(decl: u24)[idx: i32, val: i32]
+                // -> *arr_ref(decl, pop(idx)) += pop(val)
+OPCODE(OP_SETA) // SETA(decl: u24, const: i32)[idx: i32]
+                // -> *arr_ref(decl, pop(idx)) = const
 OPCODE(OP_CMUL)   // (Constant Mul) CMUL(const: i32)[a: i32]
                   // push(const*pop(a))
 OPCODE(OP_BINADD) // BINADD[a1: i32, a2: i32]
                   // -> push(pop(a1)+pop(a2))
+OPCODE(OP_LINCOMB) // LINCOMB(terms: u24, const: i32)
+                   // -> push(const + sum(coef * *int_ref(decl)))
+                   //    over the `LinTerm` run at `terms`
+OPCODE(OP_LINCOMB_E) // LINCOMB onto an empty stack, as LOAD_CONST_E
 
 OPCODE(OP_PUT)  // PUT[num: i32]
                 // -> print_num(pop(num))
-OPCODE(OP_JMP)  // (Directly)JMP(offset: i16)
+OPCODE(OP_JMP)  // (Directly)JMP(offset: i32)
                 // -> exec_ptr += offset
-OPCODE(OP_CJMP) // CJMP(cmp_type: CmpType, offset: i16)[left: i32, right: i32]
+OPCODE(OP_CJMP) // CJMP(cmp_type: CmpType, offset: i32)[left: i32, right: i32]
                 // -> if cmp(pop(left), pop(right)): jmp(offset)
+// Compare in place, `cmp` and `decl` share the slot (see `CJMP_SLOT`).
+// The word after is the JMP taken when `cmp` holds, never run by itself.
+OPCODE(OP_CJMP_VI) // CJMP_VI(cmp, decl: u16, const: i32) JMP(offset: i32)
+                   // -> if cmp(*int_ref(decl), const): jmp(offset)
+OPCODE(OP_CJMP_VV) // CJMP_VV(cmp, decl: u16, decl2: i32) JMP(offset: i32)
+                   // -> if cmp(*int_ref(decl), *int_ref(decl2)): jmp(offset)
+OPCODE(OP_CJMP_AI) // CJMP_AI(cmp, decl: u16, const: i32)
+                   //   JMP(idx: u24, offset: i32)
+                   // -> if cmp(*arr_ref(decl, *int_ref(idx)), const):
+                   //      jmp(offset)
+OPCODE(OP_SWITCH) // SWITCH(low: i32, cnts: u24)[x]
+                  // -> followed by `cnts+1` JMPs, takes the `x-low`-th,
+                  //    or the last one when `x` is out of range
+// Counted `hor` loops, `ends` holds one hidden end per decl
+OPCODE(OP_FOR_INIT) // FOR_INIT(decl: u24, offset: i32)[start: i32, end: i32]
+                    // -> if pop(start) > pop(end): jmp(offset)
+                    //    else: *int_ref(decl) = start, ends[decl] = end
+OPCODE(OP_FOR_NEXT) // FOR_NEXT(decl: u24, offset: i32)
+                    // -> if *int_ref(decl) != ends[decl]:
+                    //      ++*int_ref(decl), jmp(offset)
 OPCODE(OP_HALT) // HALT
 
+// Checked builds only
+OPCODE(OP_CHECK)  // CHECK(decl: u24)[idx: i32]
+                  // -> fail unless `idx` is in `decl`, leaves it on STACK
+OPCODE(OP_BOUNDS) // BOUNDS(decl: u24, const: coef)[start, end, rest]
+                  // -> fail unless `coef*k+rest` is in `decl` for every
+                  //    `k` in `[start, end]`
+
+// Bulk loops, `n` = end-start+1 elements when start <= end
+OPCODE(OP_FILL) // FILL(decl: u24)[start, end, dst_off, val]
+                // -> arr_ref(decl, start+dst_off)[0..n) = val
+OPCODE(OP_IOTA) // IOTA(decl: u24, const: stride)[start, end, dst_off, val]
+                // -> arr_ref(decl, start+dst_off)[k] = stride*(start+k)+val
+OPCODE(OP_COPY) // COPY(decl: u24, const: src_idx)
+                //   [start, end, dst_off, src_off, val]
+                // -> arr_ref(decl, start+dst_off)[k] =
+                //      arr_ref(decls[src_idx], start+src_off)[k] + val
+OPCODE(OP_SUMA) // SUMA(decl: u24, const: coef)[start, end, off]
+                // -> push(coef * sum(arr_ref(decl, start+off)[0..n)))
+OPCODE(OP_SERIES) // SERIES(const: stride)[start, end, val]
+                  // -> push(sum(stride*k+val for k in [start, end]))
+
 //- Deprecated -//
 // OPCODE(OP_TRIADD)  // TRIADD[a1: i32, a2: i32, a3: i32]
 //                    // -> push(pop(a1)+pop(a2)+pop(a3))
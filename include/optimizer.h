@@ -0,0 +1,43 @@
+#ifndef _OPTIMIZER_H_
+#define _OPTIMIZER_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#endif
+
+// `hor` loops with constant bounds are fully unrolled while
+// `trip count * body size` stays within UNROLL_MAX_STMTS statements,
+// and until UNROLL_BUDGET statements have been produced in total.
+#define UNROLL_MAX_STMTS 128
+#define UNROLL_BUDGET 4096
+
+typedef struct Optimizer {
+  DynArr *stmts;     // Stmt *
+  DynArr *var_decls; // VarDecl *
+  usize unroll_budget;
+#ifndef NO_DEBUG
+  struct OptimizerStats {
+    usize unrolled_hors;
+    usize bulk_loops;
+    usize reductions;
+    usize folded_ihus;
+  } stats;
+#endif
+} Optimizer;
+
+void optimizer_init(Optimizer *opt, DynArr *stmts, DynArr *var_decls);
+Optimizer *optimizer_create(DynArr *stmts, DynArr *var_decls);
+void fold_expr(Expr *expr);
+void optimizer_run(Optimizer *opt);
+#ifndef NO_DEBUG
+void optimizer_stats(Optimizer *opt);
+#endif
+
+#endif // _OPTIMIZER_H_
@@ -0,0 +1,81 @@
+#ifndef CODEGEN
+#ifdef PARALLEL
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "narrow.h"
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <pthread.h>
+#include <stddef.h>
+#endif
+
+// Consecutive top-level statements run together on a thread pool when none
+// of them reads an int another one writes, and their array accesses do
+// not overlap. Array accesses are summarized as index ranges, from the
+// value ranges of the operands and the bounds of the enclosing `hor`s.
+// Ints are private to each statement while its group runs, and written
+// back in program order, as is the output, which each buffers.
+
+#define PARALLEL_MAX_THREADS 16
+
+typedef struct DeclAccess {
+  char read;   // Ints: the value on entry may be used
+  char write;  // Ints
+  ValRange rd; // Arrays: indices read, empty when `lo` > `hi`
+  ValRange wr; // Arrays: indices written
+} DeclAccess;
+
+typedef struct ParTask {
+  Stmt *stmt;
+  DynArr accesses;  // DeclAccess, per decl
+  char opaque;      // Uses undeclared names, always run alone
+  DynArr var_decls; // VarDecl, private copy while its group runs
+  DynArr output;    // char
+} ParTask;
+
+typedef struct Parallel {
+  DynArr *stmts;     // Stmt *
+  DynArr *var_decls; // VarDecl *
+  Narrow ranges;
+  DynArr tasks; // ParTask, per top-level stmt
+  struct ParPool {
+    pthread_t *threads;
+    usize thread_cnts;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    usize next; // Tasks `[next, end)` are queued
+    usize end;
+    usize pending;
+    char stop;
+  } pool;
+#ifndef NO_DEBUG
+  struct ParallelStats {
+    usize groups;
+    usize parallel_groups;
+    usize parallel_tasks;
+    usize threads;
+  } stats;
+#endif
+} Parallel;
+
+void parallel_init(Parallel *par, DynArr *stmts, DynArr *var_decls);
+Parallel *parallel_create(DynArr *stmts, DynArr *var_decls);
+void parallel_free(Parallel *par);
+void parallel_execute(Parallel *par);
+#ifndef NO_DEBUG
+void parallel_stats(Parallel *par);
+#endif
+
+#endif // _PARALLEL_H_
+
+#endif
+#endif
@@ -16,16 +16,54 @@ enum OperandTyp {
   OPERAND_ARR_ELEM,
 };
 
+// Picks the evaluator, set by `classify_expr`
+enum ExprShape {
+  EXPR_CONST,      // c
+  EXPR_INT,        // x
+  EXPR_INT_OFFSET, // x + c
+  EXPR_INT2,       // a*x + b*y + c
+  EXPR_LINEAR,     // Int vars only
+  EXPR_GENERAL,    // With array elements
+};
+
+// `EXPR_LINEAR` sums with at least this many terms get a `TermSoA`
+#define EXPR_SOA_MIN_TERMS 16
+
+// Structure-of-arrays copy of the terms, padded to whole 32-byte vectors
+typedef struct TermSoA {
+  int *coefs;
+  const int **refs; // Bound int operands
+  usize cnts;
+} TermSoA;
+
 typedef struct Expr {
   DynArr op_terms; // OperandTerm *
   int constant;
+  enum ExprShape shape;
+  TermSoA *soa; // Set by `bind_stmts`, or NULL
 } Expr; // Use Flatten Expression
 
+// Element storage of arrays, narrowed by the range pass when values fit
+enum ElemWidth {
+  ELEM_I32,
+  ELEM_I16,
+  ELEM_I8,
+};
+
 typedef struct VarDecl VarDecl;
 
 typedef struct Operand {
   enum OperandTyp typ;
   unsigned short decl_idx;
+  // Set by `bind_stmts`: `&data.i.val`, or `arr - start` for arrays
+  union {
+    int *ref;
+    short *ref16;
+    signed char *ref8;
+  };
+  enum ElemWidth width; // Of the array, `ELEM_I32` for ints
+  // Set by the bounds pass of checked builds when the access needs no check
+  char unchecked;
   union {
     Expr idx_expr; // for ArrElem
   };
@@ -43,6 +81,7 @@ enum StmtType {
   STMT_HOR_BLK,
   STMT_YOSORO_CMD,
   STMT_SET_CMD,
+  STMT_BULK_LOOP, // Produced by the optimizer only
 };
 
 enum VarType {
@@ -55,7 +94,12 @@ typedef struct VarIntData {
 } VarIntData;
 
 typedef struct VarArrData {
-  int *arr;
+  union {
+    int *arr;
+    short *arr16;
+    signed char *arr8;
+  };
+  enum ElemWidth width;
 } VarArrData;
 
 typedef union VarData {
@@ -104,11 +148,20 @@ typedef struct WhileStmt {
   DynArr stmts; // Stmt *
 } WhileStmt;
 
+// Checks `arr[coefficient*var + rest]` for every `var` of a `hor` at once,
+// before its first iteration
+typedef struct BoundsHoist {
+  unsigned short decl_idx;
+  int coefficient;
+  Expr rest; // Invariant in the loop
+} BoundsHoist;
+
 typedef struct HorStmt {
   Operand var;
   Expr start;
   Expr end;
-  DynArr stmts; // Stmt *
+  DynArr stmts;   // Stmt *
+  DynArr *hoists; // BoundsHoist, set by the bounds pass, or NULL
 } HorStmt;
 
 typedef struct YosoroStmt {
@@ -120,6 +173,33 @@ typedef struct SetStmt {
   Expr expr;
 } SetStmt;
 
+enum BulkKind {
+  BULK_FILL,   // dst[var+dst_offset] = val
+  BULK_IOTA,   // dst[var+dst_offset] = stride*var + val
+  BULK_COPY,   // dst[var+dst_offset] = srcs[0] + val
+  BULK_REDUCE, // dst = dst + sum(srcs) + stride*var + val, `dst` is an int
+};
+
+typedef struct BulkSrc {
+  int coefficient;
+  unsigned short decl_idx;
+  Expr offset; // coefficient*#decl_idx[var+offset]
+} BulkSrc;
+
+// `{ hor var, start, end  :set dst[var+dst_offset], ... }`
+// Offsets and `val` are loop-invariant.
+typedef struct BulkStmt {
+  enum BulkKind kind;
+  Operand var;
+  Expr start;
+  Expr end;
+  unsigned short dst_idx;
+  Expr dst_offset;
+  DynArr srcs; // BulkSrc
+  int stride;
+  Expr val;
+} BulkStmt;
+
 typedef struct Stmt {
   enum StmtType typ;
   union {
@@ -128,7 +208,9 @@ typedef struct Stmt {
     HorStmt hor;
     YosoroStmt yosoro;
     SetStmt set;
+    BulkStmt bulk;
   } inner;
+  usize line; // Source line of its first token
 } Stmt;
 
 typedef struct Parser {
@@ -146,6 +228,23 @@ void parser_free(Parser *parser);
 unsigned short operand_finder(Parser *parser, const char *var_name,
                               enum OperandTyp type);
 DynArr *parser_parse(Parser *parser);
+void free_expr(Expr *expr);
+void free_operand(Operand *op);
+void free_stmt(Stmt *stmt);
+void free_stmts(DynArr *stmts);
+void clone_expr(Expr *dest, Expr *src);
+void clone_operand(Operand *dest, Operand *src);
+void clone_stmt(Stmt *dest, Stmt *src);
+void clone_stmts(DynArr *dest, DynArr *src);
+int is_expr_eq(Expr *a, Expr *b);
+void bind_stmts(DynArr *stmts, DynArr *var_decls);
+int is_operand_eq(Operand *a, Operand *b);
+int expr_refs_decl(Expr *expr, unsigned short decl_idx);
+int operand_refs_decl(Operand *operand, unsigned short decl_idx);
+int stmts_refs_decl(DynArr *stmts, unsigned short decl_idx);
+int stmts_writes_decl(DynArr *stmts, unsigned short decl_idx);
+void classify_expr(Expr *expr);
+void optimize_expr(Parser *parser, Expr *expr);
 #ifndef NO_DEBUG
 void debug_parser(Parser *parser);
 #endif
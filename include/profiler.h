@@ -0,0 +1,79 @@
+#if !defined(CODEGEN) || defined(PROFILE)
+#ifdef PROFILE
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#endif
+
+#if defined(__x86_64__)
+#ifndef NO_STD_INC
+#include <x86intrin.h>
+#endif
+#endif
+
+// Profiled builds charge the ticks between two dispatches of the
+// interpreter to the flat entry that was running. The loop end entries are
+// charged to their header, so the self time of a block is its condition and
+// stepping. The flat array is pre-order, which makes the total time of a
+// block the sum of the self time of `[header, past the block)`.
+
+#if defined(__x86_64__)
+#define PROFILE_UNIT "cycles"
+static inline uint64_t profiler_clock(void) { return __rdtsc(); }
+#else
+#define PROFILE_UNIT "ns"
+static inline uint64_t profiler_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+typedef struct StmtProfile {
+  usize hits;    // Header dispatches, `while` counts each recheck
+  usize iters;   // Passes through the loop end
+  uint64_t self; // Ticks
+} StmtProfile;
+
+typedef struct Profiler {
+  DynArr *flats;   // FlatStmt
+  DynArr profiles; // StmtProfile, per flat entry
+  usize cur;       // Entry being charged
+  uint64_t last;
+} Profiler;
+
+void profiler_init(Profiler *profiler, DynArr *flats);
+void profiler_free(Profiler *profiler);
+void profiler_stop(Profiler *profiler);
+// Annotated `src` to stderr
+void profiler_report(Profiler *profiler, const char *src);
+
+static inline void profiler_enter(Profiler *profiler, usize idx,
+                                  char loop_end) {
+  uint64_t now = profiler_clock();
+  StmtProfile *profiles = profiler->profiles.items;
+  profiles[profiler->cur].self += now - profiler->last;
+  profiler->last = now;
+  profiler->cur = idx;
+  if (loop_end) {
+    profiles[idx].iters++;
+  } else {
+    profiles[idx].hits++;
+  }
+}
+
+#endif // _PROFILER_H_
+
+#endif
+#endif
@@ -0,0 +1,51 @@
+// REGOP(op, slots)(dst, a, b, imm)
+// `slots` are the fields that name register slots. Slots `[0, decls)` hold
+// the int vars, temporaries and interned constants follow. Arrays are named
+// by their decl index, `pc` is the instruction index.
+
+#ifndef REGOP
+#define DEFAULT_DEF
+#define REGOP(x, slots)
+#endif
+
+REGOP(ROP_MOV, RS_DST | RS_A)          // dst = a
+REGOP(ROP_MOVI, RS_DST)                // dst = imm
+REGOP(ROP_ADD, RS_DST | RS_A | RS_B)   // dst = a + b
+REGOP(ROP_ADDI, RS_DST | RS_A)         // dst = a + imm
+REGOP(ROP_MULI, RS_DST | RS_A)         // dst = a * imm
+REGOP(ROP_ADDM, RS_DST | RS_A | RS_B)  // dst = a + b * imm
+REGOP(ROP_LDA, RS_DST | RS_B)          // dst = arr(a)[b]
+REGOP(ROP_LDA16, RS_DST | RS_B)        // Arrays narrowed to 16 or 8 bits
+REGOP(ROP_LDA8, RS_DST | RS_B)
+REGOP(ROP_STA, RS_DST | RS_B)          // arr(a)[b] = dst
+REGOP(ROP_STA16, RS_DST | RS_B)
+REGOP(ROP_STA8, RS_DST | RS_B)
+
+REGOP(ROP_JMP, 0)             // pc += imm
+REGOP(ROP_JLT, RS_A | RS_B)   // if a < b: pc += imm
+REGOP(ROP_JEQ, RS_A | RS_B)
+REGOP(ROP_JLE, RS_A | RS_B)
+REGOP(ROP_JGT, RS_A | RS_B)
+REGOP(ROP_JNE, RS_A | RS_B)
+REGOP(ROP_JGE, RS_A | RS_B)
+
+REGOP(ROP_PUT, RS_A) // print_num(a)
+REGOP(ROP_HALT, 0)
+
+// Checked builds only
+REGOP(ROP_CHECK, RS_B) // fail unless `b` is in arr(a)
+REGOP(ROP_BOUNDS, 0)   // fail unless `imm*k+b[2]` is in arr(a) for every `k`
+                       // in `[b[0], b[1]]`
+
+// Bulk loops, their operands are the consecutive temporaries `b[0..]`:
+// start, end, then as the stack VM pushes them
+REGOP(ROP_FILL, 0)          // arr(a)[start+dst_off ..] = val
+REGOP(ROP_IOTA, 0)          // imm: stride
+REGOP(ROP_COPY, 0)          // imm: decl index of the source
+REGOP(ROP_SUMA, RS_DST)     // dst = imm * sum(arr(a)[start+off ..])
+REGOP(ROP_SERIES, RS_DST)   // dst = sum(imm*k+val for k in [start, end])
+
+#ifdef DEFAULT_DEF
+#undef DEFAULT_DEF
+#undef REGOP
+#endif
@@ -0,0 +1,64 @@
+#ifdef CODEGEN
+#ifdef REGVM
+
+#ifndef _REGGEN_H_
+#define _REGGEN_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "parser.h"
+#include "utils.h"
+#endif
+
+// Fields of a `RegCode` that name register slots
+#define RS_DST 0b001
+#define RS_A 0b010
+#define RS_B 0b100
+
+enum RegOpType {
+#undef REGOP
+#define REGOP(x, slots) x,
+#include "regcodes.h"
+#undef REGOP
+};
+
+typedef unsigned short reg_slot;
+
+// Three-address code: `x = x + y` is one `ADD x, x, y`
+typedef struct RegCode {
+  unsigned char typ; // enum RegOpType
+  reg_slot dst;
+  reg_slot a;
+  reg_slot b;
+  int imm;
+} RegCode;
+
+// Constants are numbered from REG_CONST_MARK until every temporary is
+// known, then moved right after them
+#define REG_CONST_MARK 0x8000
+
+typedef struct RegGen {
+  DynArr codes;      // RegCode
+  DynArr *stmts;     // Stmt *
+  DynArr *var_decls; // VarDecl *
+  DynArr consts;     // int, interned
+  usize temps;       // In use
+  usize max_temps;
+  usize slot_cnts; // Vars, temporaries and constants
+} RegGen;
+
+void rg_init(RegGen *rg, DynArr *stmts, DynArr *var_decls);
+RegGen *rg_create(DynArr *stmts, DynArr *var_decls);
+void rg_free(RegGen *rg);
+void rg_gen(RegGen *rg);
+int rg_slot_mask(enum RegOpType typ);
+#ifndef NO_DEBUG
+const char *reg_op_type(enum RegOpType typ);
+void rg_debug(RegGen *rg);
+#endif
+
+#endif // _REGGEN_H_
+
+#endif
+#endif
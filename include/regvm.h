@@ -0,0 +1,29 @@
+#ifdef CODEGEN
+#ifdef REGVM
+
+#ifndef _REGVM_H_
+#define _REGVM_H_
+
+#pragma once
+
+#ifndef NO_CUSTOM_INC
+#include "reggen.h"
+#include "utils.h"
+#include "vm.h"
+#endif
+
+// Runs the code of a `RegGen` over one register file. Int vars are loaded
+// into their slots before the run and stored back after it.
+typedef struct RegVM {
+  DynArr *var_decls; // VarDecl *
+  RegGen *rg;
+} RegVM;
+
+void reg_vm_init(RegVM *vm, DynArr *var_decls, RegGen *rg);
+RegVM *reg_vm_create(DynArr *var_decls, RegGen *rg);
+void reg_vm_execute(RegVM *vm);
+
+#endif // _REGVM_H_
+
+#endif
+#endif
@@ -65,7 +65,7 @@ static inline void da_set(DynArr *dyn_arr, usize idx, void *item) {
 }
 static inline void *da_pushs_back(DynArr *dyn_arr, usize cnts) {
   if (dyn_arr->item_cnts + cnts >= dyn_arr->capacity) {
-    while (dyn_arr->capacity > dyn_arr->item_cnts + cnts) { // loop
+    while (dyn_arr->capacity <= dyn_arr->item_cnts + cnts) { // loop
       dyn_arr->capacity *= 2;                               // 2x Extend
     }
     dyn_arr->items =
@@ -81,6 +81,15 @@ static inline void *da_pushs_back(DynArr *dyn_arr, usize cnts) {
 }
 void da_free(DynArr *dyn_arr);
 
+void print_num(int num);
+void out_write(const char *str, usize len); // Program output
+#ifdef RESULT_CACHE
+void out_capture(DynArr *buf); // char, NULL to stop capturing
+#endif
+#ifdef PARALLEL
+void out_redirect(DynArr *buf); // char, of the calling thread, NULL to stop
+#endif
+
 typedef struct StrPoolNode {
   char *str;
   usize len;
@@ -8,10 +8,16 @@
 #include "utils.h"
 #endif
 
+// GCC and Clang jump straight from each handler to the next one, through
+// the label of every instruction translated before the run
+#if defined(__GNUC__) && !defined(NO_THREADED)
+#define VM_THREADED
+#endif
+
 typedef struct Stack {
   int *top;
-  int bottom[512];
-  // int *bottom;
+  int tos; // Cached top, its own slot below `top` is stale
+  int *bottom;
   int capacity;
 } Stack;
 
@@ -19,11 +25,17 @@ typedef struct CyrVM {
   DynArr *codes;
   // Stack stack;
   DynArr *var_decls;
+  VarDecl *decls;     // Decl indices of the codes resolve against it
+  LinTerm *lin_terms; // Runs of the LINCOMBs, from `CodeGen`
+  int max_depth;      // Of the operand stack, from `CodeGen`
+  int *for_ends;      // Hidden end of the counted `hor` over each decl
 } CyrVM;
 
 int get_stack_delta(enum OpCodeType typ);
-void cyr_vm_init(CyrVM *cyr_vm, DynArr *var_decls, DynArr *codes);
-CyrVM *cyr_vm_create(DynArr *var_decls, DynArr *codes);
+void cyr_vm_init(CyrVM *cyr_vm, DynArr *var_decls, DynArr *codes,
+                 DynArr *lin_terms, int max_depth);
+CyrVM *cyr_vm_create(DynArr *var_decls, DynArr *codes, DynArr *lin_terms,
+                     int max_depth);
 void cyr_vm_execute(CyrVM *cyr_vm);
 
 #endif
@@ -0,0 +1,325 @@
+#ifdef CHECKED
+
+#ifndef NO_CUSTOM_INC
+#include "bounds.h"
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+void bounds_init(Bounds *bounds, DynArr *stmts, DynArr *var_decls) {
+  memset(bounds, 0, sizeof(Bounds));
+  bounds->stmts = stmts;
+  bounds->var_decls = var_decls;
+  usize cnts = var_decls->item_cnts;
+  da_init(&bounds->ranges, sizeof(Range), cnts ? cnts : 1);
+  memset(bounds->ranges.items, 0, cnts * sizeof(Range));
+  bounds->ranges.item_cnts = cnts;
+}
+
+Bounds *bounds_create(DynArr *stmts, DynArr *var_decls) {
+  Bounds *bounds = malloc(sizeof(Bounds));
+  bounds_init(bounds, stmts, var_decls);
+  return bounds;
+}
+
+void bounds_free(Bounds *bounds) { da_free(&bounds->ranges); }
+
+static VarDecl *bounds_decl(Bounds *bounds, unsigned short decl_idx) {
+  return (VarDecl *)(bounds->var_decls->items) + decl_idx;
+}
+
+static Range *decl_range(Bounds *bounds, unsigned short decl_idx) {
+  return (Range *)(bounds->ranges.items) + decl_idx;
+}
+
+/* Value ranges */
+
+static void widen_range(Range *range, long long val) {
+  if (val < range->lo) {
+    range->lo = val;
+  }
+  if (val > range->hi) {
+    range->hi = val;
+  }
+}
+
+// Ranges that hold everywhere: ints only ever set to constants stay within
+// those constants and their initial 0
+static void collect_writes(Bounds *bounds, DynArr *stmts) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      collect_writes(bounds, &stmt->inner.ihu.stmts);
+      break;
+    case STMT_WHILE_BLK:
+      collect_writes(bounds, &stmt->inner.while_stmt.stmts);
+      break;
+    case STMT_HOR_BLK:
+      decl_range(bounds, stmt->inner.hor.var.decl_idx)->known = 0;
+      collect_writes(bounds, &stmt->inner.hor.stmts);
+      break;
+    case STMT_SET_CMD: {
+      SetStmt *set = &stmt->inner.set;
+      Range *range = decl_range(bounds, set->operand.decl_idx);
+      if (set->expr.op_terms.item_cnts) {
+        range->known = 0;
+      } else {
+        widen_range(range, set->expr.constant);
+      }
+    } break;
+    case STMT_BULK_LOOP:
+      decl_range(bounds, stmt->inner.bulk.var.decl_idx)->known = 0;
+      decl_range(bounds, stmt->inner.bulk.dst_idx)->known = 0;
+      break;
+    case STMT_YOSORO_CMD:
+      break;
+    }
+  }
+}
+
+// Exact in 64 bits, or unknown
+static int expr_range(Bounds *bounds, Expr *expr, Range *res) {
+  long long lo = expr->constant;
+  long long hi = expr->constant;
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    if (op_term->operand.typ != OPERAND_INT_VAR) {
+      return 0;
+    }
+    Range *range = decl_range(bounds, op_term->operand.decl_idx);
+    if (!range->known) {
+      return 0;
+    }
+    long long coef = op_term->coefficient;
+    long long a, b;
+    if (__builtin_mul_overflow(range->lo, coef, &a) ||
+        __builtin_mul_overflow(range->hi, coef, &b)) {
+      return 0;
+    }
+    if (coef < 0) {
+      long long t = a;
+      a = b;
+      b = t;
+    }
+    if (__builtin_add_overflow(lo, a, &lo) ||
+        __builtin_add_overflow(hi, b, &hi)) {
+      return 0;
+    }
+  }
+  res->lo = lo;
+  res->hi = hi;
+  res->known = 1;
+  return 1;
+}
+
+/* Hoisting */
+
+// Whether `expr` is int-only and none of its operands change in `stmts`
+static int is_invariant_expr(Expr *expr, DynArr *stmts) {
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    if (op_term->operand.typ != OPERAND_INT_VAR ||
+        stmts_writes_decl(stmts, op_term->operand.decl_idx)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Accesses run on every iteration of `hor` can be checked before it when
+// its variable walks `[start, end]` untouched. The VM re-evaluates `end`
+// each iteration, so that must not change either.
+static int is_hoist_target(HorStmt *hor) {
+  return hor->var.typ == OPERAND_INT_VAR &&
+         !stmts_writes_decl(&hor->stmts, hor->var.decl_idx) &&
+         is_invariant_expr(&hor->end, &hor->stmts);
+}
+
+static int try_hoist(Bounds *bounds, HorStmt *hor, Operand *operand) {
+  unsigned short var_idx = hor->var.decl_idx;
+  BoundsHoist hoist = {.decl_idx = operand->decl_idx};
+  clone_expr(&hoist.rest, &operand->idx_expr);
+  DynArr *terms = &hoist.rest.op_terms;
+  OperandTerm *op_term = terms->items;
+  for (int i = 0; i < terms->item_cnts; i++, op_term++) {
+    if (op_term->operand.typ == OPERAND_INT_VAR &&
+        op_term->operand.decl_idx == var_idx) {
+      hoist.coefficient = op_term->coefficient;
+      memmove(op_term, op_term + 1,
+              (terms->item_cnts - i - 1) * sizeof(OperandTerm));
+      terms->item_cnts--;
+      break;
+    }
+  }
+  if (!is_invariant_expr(&hoist.rest, &hor->stmts)) {
+    free_expr(&hoist.rest);
+    return 0;
+  }
+  classify_expr(&hoist.rest);
+  if (!hor->hoists) {
+    hor->hoists = malloc(sizeof(DynArr));
+    da_init(hor->hoists, sizeof(BoundsHoist), 2);
+  }
+  BoundsHoist *same = hor->hoists->items;
+  for (int i = 0; i < hor->hoists->item_cnts; i++, same++) {
+    if (same->decl_idx == hoist.decl_idx &&
+        same->coefficient == hoist.coefficient &&
+        is_expr_eq(&same->rest, &hoist.rest)) {
+      free_expr(&hoist.rest);
+      return 1;
+    }
+  }
+  *(BoundsHoist *)da_try_push_back(hor->hoists) = hoist;
+  bounds->stats.hoists++;
+  return 1;
+}
+
+/* Classifying accesses */
+
+// `hoist_to`: the `hor` running the visited code on every iteration, if any
+static void visit_expr(Bounds *bounds, Expr *expr, HorStmt *hoist_to);
+
+static void visit_access(Bounds *bounds, Operand *operand, HorStmt *hoist_to) {
+  if (operand->typ != OPERAND_ARR_ELEM) {
+    return;
+  }
+  visit_expr(bounds, &operand->idx_expr, hoist_to);
+  bounds->stats.accesses++;
+  VarDecl *decl = bounds_decl(bounds, operand->decl_idx);
+  Range idx;
+  if (expr_range(bounds, &operand->idx_expr, &idx) && idx.lo >= decl->start &&
+      idx.hi <= decl->end) {
+    operand->unchecked = 1;
+    bounds->stats.proven++;
+  } else if (hoist_to && try_hoist(bounds, hoist_to, operand)) {
+    operand->unchecked = 1;
+    bounds->stats.hoisted++;
+  } else {
+    operand->unchecked = 0;
+    bounds->stats.checked++;
+  }
+}
+
+static void visit_expr(Bounds *bounds, Expr *expr, HorStmt *hoist_to) {
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    visit_access(bounds, &op_term->operand, hoist_to);
+  }
+}
+
+static void visit_cond(Bounds *bounds, Cond *cond, HorStmt *hoist_to) {
+  visit_expr(bounds, &cond->left, hoist_to);
+  visit_expr(bounds, &cond->right, hoist_to);
+}
+
+static void visit_stmts(Bounds *bounds, DynArr *stmts, HorStmt *hoist_to);
+
+static void visit_hor(Bounds *bounds, HorStmt *hor, HorStmt *hoist_to) {
+  // The variable is only stored once the loop is entered
+  visit_access(bounds, &hor->var, NULL);
+  visit_expr(bounds, &hor->start, hoist_to);
+  visit_expr(bounds, &hor->end, hoist_to);
+  if (hor->var.typ != OPERAND_INT_VAR) {
+    visit_stmts(bounds, &hor->stmts, NULL);
+    return;
+  }
+  // Within the body, an untouched variable stays in `[start, end]`
+  Range *var_range = decl_range(bounds, hor->var.decl_idx);
+  Range saved = *var_range;
+  Range start, end;
+  if (!stmts_writes_decl(&hor->stmts, hor->var.decl_idx) &&
+      expr_range(bounds, &hor->start, &start) &&
+      expr_range(bounds, &hor->end, &end)) {
+    var_range->lo = start.lo;
+    var_range->hi = end.hi;
+    var_range->known = 1;
+  }
+  visit_stmts(bounds, &hor->stmts, is_hoist_target(hor) ? hor : NULL);
+  *var_range = saved;
+}
+
+static void visit_bulk(Bounds *bounds, BulkStmt *bulk, HorStmt *hoist_to) {
+  // The kernels check whole ranges, once per run
+  bounds->stats.bulk++;
+  visit_access(bounds, &bulk->var, NULL);
+  visit_expr(bounds, &bulk->start, hoist_to);
+  visit_expr(bounds, &bulk->end, hoist_to);
+  // Only evaluated when the range is not empty
+  visit_expr(bounds, &bulk->dst_offset, NULL);
+  BulkSrc *src = bulk->srcs.items;
+  for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+    visit_expr(bounds, &src->offset, NULL);
+  }
+  visit_expr(bounds, &bulk->val, NULL);
+}
+
+static void visit_stmts(Bounds *bounds, DynArr *stmts, HorStmt *hoist_to) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      visit_cond(bounds, &stmt->inner.ihu.cond, hoist_to);
+      visit_stmts(bounds, &stmt->inner.ihu.stmts, NULL);
+      break;
+    case STMT_WHILE_BLK: // The condition runs at least once
+      visit_cond(bounds, &stmt->inner.while_stmt.cond, hoist_to);
+      visit_stmts(bounds, &stmt->inner.while_stmt.stmts, NULL);
+      break;
+    case STMT_HOR_BLK:
+      visit_hor(bounds, &stmt->inner.hor, hoist_to);
+      break;
+    case STMT_YOSORO_CMD:
+      visit_expr(bounds, &stmt->inner.yosoro.expr, hoist_to);
+      break;
+    case STMT_SET_CMD:
+      visit_expr(bounds, &stmt->inner.set.expr, hoist_to);
+      visit_access(bounds, &stmt->inner.set.operand, hoist_to);
+      break;
+    case STMT_BULK_LOOP:
+      visit_bulk(bounds, &stmt->inner.bulk, hoist_to);
+      break;
+    }
+  }
+}
+
+void bounds_run(Bounds *bounds) {
+  Range *range = bounds->ranges.items;
+  for (int i = 0; i < bounds->ranges.item_cnts; i++, range++) {
+    range->lo = range->hi = 0;
+    range->known = bounds_decl(bounds, i)->typ == VAR_INT;
+  }
+  collect_writes(bounds, bounds->stmts);
+  visit_stmts(bounds, bounds->stmts, NULL);
+}
+
+// Checked runs always report, the numbers are what the mode costs
+void bounds_stats(Bounds *bounds) {
+  struct BoundsStats stats = bounds->stats;
+  fprintf(stderr,
+          "Bounds Checks:\n"
+          "  Accesses  : %u\n"
+          "  Proven    : %u\n"
+          "  Hoisted   : %u (into %u loop checks)\n"
+          "  Per access: %u\n"
+          "  Bulk loops: %u\n"
+          "  Eliminated: %u\n",
+          stats.accesses, stats.proven, stats.hoisted, stats.hoists,
+          stats.checked, stats.bulk, stats.proven + stats.hoisted);
+}
+
+void bounds_fail(VarDecl *decl, long long idx) {
+  fflush(stdout);
+  fprintf(stderr, "\nIndex %lld out of bounds of %s[%d..%d]\n", idx,
+          decl->name, decl->start, decl->end);
+  exit(1);
+}
+
+#endif
@@ -0,0 +1,303 @@
+#ifdef RESULT_CACHE
+
+#ifndef NO_CUSTOM_INC
+#include "cache.h"
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#define CACHE_MAGIC "CYRC"
+#define CACHE_SUFFIX ".cyc"
+
+typedef struct CacheHeader {
+  char magic[4];
+  uint32_t status;
+  uint32_t len;
+} CacheHeader;
+
+// FNV-1a over the canonical AST, names are never hashed (only `decl_idx`)
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static uint64_t hash_u32(uint64_t h, uint32_t val) {
+  for (int i = 0; i < 4; i++, val >>= 8) {
+    h ^= val & 0xff;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+static uint64_t hash_expr(uint64_t h, Expr *expr);
+
+static uint64_t hash_operand(uint64_t h, Operand *operand) {
+  h = hash_u32(h, operand->typ);
+  h = hash_u32(h, operand->decl_idx);
+  if (operand->typ == OPERAND_ARR_ELEM) {
+    h = hash_expr(h, &operand->idx_expr);
+  }
+  return h;
+}
+
+static uint64_t hash_expr(uint64_t h, Expr *expr) {
+  // Terms are already in `optimize_expr` order
+  h = hash_u32(h, expr->constant);
+  h = hash_u32(h, expr->op_terms.item_cnts);
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    h = hash_u32(h, op_term->coefficient);
+    h = hash_operand(h, &op_term->operand);
+  }
+  return h;
+}
+
+static uint64_t hash_cond(uint64_t h, Cond *cond) {
+  h = hash_u32(h, cond->typ);
+  h = hash_expr(h, &cond->left);
+  return hash_expr(h, &cond->right);
+}
+
+static uint64_t hash_stmts(uint64_t h, DynArr *stmts) {
+  Stmt *stmt = stmts->items;
+  h = hash_u32(h, stmts->item_cnts);
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    h = hash_u32(h, stmt->typ);
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      h = hash_cond(h, &stmt->inner.ihu.cond);
+      h = hash_stmts(h, &stmt->inner.ihu.stmts);
+      break;
+    case STMT_WHILE_BLK:
+      h = hash_cond(h, &stmt->inner.while_stmt.cond);
+      h = hash_stmts(h, &stmt->inner.while_stmt.stmts);
+      break;
+    case STMT_HOR_BLK:
+      h = hash_operand(h, &stmt->inner.hor.var);
+      h = hash_expr(h, &stmt->inner.hor.start);
+      h = hash_expr(h, &stmt->inner.hor.end);
+      h = hash_stmts(h, &stmt->inner.hor.stmts);
+      break;
+    case STMT_YOSORO_CMD:
+      h = hash_expr(h, &stmt->inner.yosoro.expr);
+      break;
+    case STMT_SET_CMD:
+      h = hash_operand(h, &stmt->inner.set.operand);
+      h = hash_expr(h, &stmt->inner.set.expr);
+      break;
+    case STMT_BULK_LOOP: // Not produced by the parser
+      break;
+    }
+  }
+  return h;
+}
+
+// Build flags that pick the engine or change the output or exit status:
+// engines may differ on edge cases, checked builds stop on bad indices,
+// and profiled and debug builds print more
+static uint32_t build_flags(void) {
+  uint32_t flags = 0;
+#ifdef CODEGEN
+  flags |= 1 << 0;
+#endif
+#ifdef REGVM
+  flags |= 1 << 1;
+#endif
+#ifdef CLOSURE
+  flags |= 1 << 2;
+#endif
+#ifdef PARALLEL
+  flags |= 1 << 3;
+#endif
+#ifdef NO_OPTIMIZE
+  flags |= 1 << 4;
+#endif
+#ifdef CHECKED
+  flags |= 1 << 5;
+#endif
+#ifdef PROFILE
+  flags |= 1 << 6;
+#endif
+#ifndef NO_DEBUG
+  flags |= 1 << 7;
+#endif
+  return flags;
+}
+
+uint64_t cache_hash_program(DynArr *stmts, DynArr *var_decls) {
+  uint64_t h = FNV_OFFSET;
+  h = hash_u32(h, build_flags());
+  VarDecl *decl = var_decls->items;
+  h = hash_u32(h, var_decls->item_cnts);
+  for (int i = 0; i < var_decls->item_cnts; i++, decl++) {
+    h = hash_u32(h, decl->typ);
+    if (decl->typ == VAR_ARR) {
+      h = hash_u32(h, decl->start);
+      h = hash_u32(h, decl->end);
+    }
+  }
+  return hash_stmts(h, stmts);
+}
+
+void cache_init(ResultCache *cache, uint64_t key) {
+  memset(cache, 0, sizeof(ResultCache));
+  cache->key = key;
+  cache->dir = getenv("CYR_CACHE_DIR");
+  if (!cache->dir || !*cache->dir) {
+    cache->dir = CACHE_DEFAULT_DIR;
+  }
+  const char *max_bytes = getenv("CYR_CACHE_MAX_BYTES");
+  cache->max_bytes = max_bytes ? strtoul(max_bytes, NULL, 10) : 0;
+  if (!cache->max_bytes) {
+    cache->max_bytes = CACHE_DEFAULT_MAX_BYTES;
+  }
+  snprintf(cache->path, sizeof(cache->path), "%s/%016llx" CACHE_SUFFIX,
+           cache->dir, (unsigned long long)key);
+  da_init(&cache->output, sizeof(char), 256);
+}
+
+void cache_free(ResultCache *cache) {
+  out_capture(NULL);
+  da_free(&cache->output);
+}
+
+int cache_replay(ResultCache *cache, int *status) {
+  FILE *fp = fopen(cache->path, "rb");
+  if (!fp) {
+    return 0;
+  }
+  CacheHeader header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, CACHE_MAGIC, 4) != 0 ||
+      header.len > CACHE_MAX_ENTRY_BYTES) {
+    fclose(fp);
+    return 0;
+  }
+  char *payload = malloc(header.len + 1);
+  usize nread = fread(payload, 1, header.len, fp);
+  fclose(fp);
+  if (nread != header.len) {
+    free(payload);
+    return 0;
+  }
+  fwrite(payload, 1, header.len, stdout);
+  free(payload);
+  utime(cache->path, NULL); // Touch for LRU
+  *status = header.status;
+  return 1;
+}
+
+void cache_begin(ResultCache *cache) {
+  cache->output.item_cnts = 0;
+  out_capture(&cache->output);
+}
+
+typedef struct CacheEntry {
+  char name[64];
+  usize size;
+  struct timespec mtime;
+} CacheEntry;
+
+static int compare_cache_entries(const void *a, const void *b) {
+  const CacheEntry *entry_a = a;
+  const CacheEntry *entry_b = b;
+  if (entry_a->mtime.tv_sec != entry_b->mtime.tv_sec) {
+    return entry_a->mtime.tv_sec < entry_b->mtime.tv_sec ? -1 : 1;
+  }
+  if (entry_a->mtime.tv_nsec != entry_b->mtime.tv_nsec) {
+    return entry_a->mtime.tv_nsec < entry_b->mtime.tv_nsec ? -1 : 1;
+  }
+  return 0;
+}
+
+static void cache_evict(ResultCache *cache) {
+  DIR *dir = opendir(cache->dir);
+  if (!dir) {
+    return;
+  }
+  DynArr entries;
+  da_init(&entries, sizeof(CacheEntry), 16);
+  usize total = 0;
+  char path[CACHE_PATH_MAX];
+  struct dirent *dirent;
+  while ((dirent = readdir(dir))) {
+    usize len = strlen(dirent->d_name);
+    usize suffix_len = sizeof(CACHE_SUFFIX) - 1;
+    if (len <= suffix_len || len >= sizeof(((CacheEntry *)0)->name) ||
+        strcmp(dirent->d_name + len - suffix_len, CACHE_SUFFIX) != 0) {
+      continue;
+    }
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, dirent->d_name);
+    if (stat(path, &st) != 0) {
+      continue;
+    }
+    CacheEntry *entry = da_try_push_back(&entries);
+    memcpy(entry->name, dirent->d_name, len + 1);
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    total += entry->size;
+  }
+  closedir(dir);
+  // Least recently used first
+  qsort(entries.items, entries.item_cnts, sizeof(CacheEntry),
+        compare_cache_entries);
+  CacheEntry *entry = entries.items;
+  for (int i = 0; i < entries.item_cnts && total > cache->max_bytes;
+       i++, entry++) {
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, entry->name);
+    if (remove(path) == 0) {
+      total -= entry->size;
+    }
+  }
+  da_free(&entries);
+}
+
+void cache_store(ResultCache *cache, int status) {
+  out_capture(NULL);
+  fflush(stdout);
+  usize len = cache->output.item_cnts;
+  if (len > CACHE_MAX_ENTRY_BYTES ||
+      len + sizeof(CacheHeader) > cache->max_bytes) {
+    return;
+  }
+  mkdir(cache->dir, 0755);
+  // Write aside and rename, so readers never see a partial entry. Each
+  // writer gets its own file, which eviction skips for lacking the suffix.
+  char tmp_path[CACHE_PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp-XXXXXX", cache->dir);
+  int fd = mkstemp(tmp_path);
+  if (fd < 0) {
+    return;
+  }
+  fchmod(fd, 0644);
+  FILE *fp = fdopen(fd, "wb");
+  if (!fp) {
+    close(fd);
+    remove(tmp_path);
+    return;
+  }
+  CacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, 4);
+  header.status = status;
+  header.len = len;
+  int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+           fwrite(cache->output.items, 1, len, fp) == len;
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tmp_path, cache->path) != 0) {
+    remove(tmp_path);
+    return;
+  }
+  cache_evict(cache);
+}
+
+#endif
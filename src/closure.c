@@ -0,0 +1,389 @@
+#ifndef CODEGEN
+#ifdef CLOSURE
+
+#ifndef NO_CUSTOM_INC
+#include "closure.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+void closure_init(Closure *closure, DynArr *stmts, DynArr *var_decls) {
+  memset(closure, 0, sizeof(Closure));
+  closure->stmts = stmts;
+  closure->var_decls = var_decls;
+  da_init(&closure->allocs, sizeof(void *), 64);
+  interpreter_init(&closure->interpreter, stmts, var_decls);
+}
+
+Closure *closure_create(DynArr *stmts, DynArr *var_decls) {
+  Closure *closure = malloc(sizeof(Closure));
+  closure_init(closure, stmts, var_decls);
+  return closure;
+}
+
+void closure_free(Closure *closure) {
+  void **alloc = closure->allocs.items;
+  for (int i = 0; i < closure->allocs.item_cnts; i++, alloc++) {
+    free(*alloc);
+  }
+  da_free(&closure->allocs);
+  interpreter_free(&closure->interpreter);
+}
+
+static void *closure_alloc(Closure *closure, usize size) {
+  void *mem = malloc(size ? size : 1);
+  *(void **)da_try_push_back(&closure->allocs) = mem;
+  return mem;
+}
+
+/* Expressions */
+
+static inline int cterm_load(const CTerm *term) {
+  if (term->ref) {
+    return *term->ref;
+  }
+  int idx = term->idx->fn(term->idx);
+  switch (term->width) {
+  case ELEM_I16:
+    return term->base16[idx];
+  case ELEM_I8:
+    return term->base8[idx];
+  default:
+    return term->base[idx];
+  }
+}
+
+static inline void cterm_store(const CTerm *term, int val) {
+  if (term->ref) {
+    *term->ref = val;
+    return;
+  }
+  int idx = term->idx->fn(term->idx);
+  switch (term->width) {
+  case ELEM_I32:
+    term->base[idx] = val;
+    break;
+  case ELEM_I16:
+    term->base16[idx] = val;
+    break;
+  case ELEM_I8:
+    term->base8[idx] = val;
+    break;
+  }
+}
+
+static int ce_const(const CExpr *expr) { return expr->constant; }
+
+static int ce_int(const CExpr *expr) { return *expr->a + expr->constant; }
+
+static int ce_int_coef(const CExpr *expr) {
+  return *expr->a * expr->coef_a + expr->constant;
+}
+
+static int ce_int2(const CExpr *expr) {
+  return *expr->a * expr->coef_a + *expr->b * expr->coef_b + expr->constant;
+}
+
+static int ce_linear(const CExpr *expr) {
+  int res = expr->constant;
+  CTerm *term = expr->terms;
+  for (usize i = 0; i < expr->term_cnts; i++, term++) {
+    res += *term->ref * term->coefficient;
+  }
+  return res;
+}
+
+static int ce_general(const CExpr *expr) {
+  int res = expr->constant;
+  CTerm *term = expr->terms;
+  for (usize i = 0; i < expr->term_cnts; i++, term++) {
+    res += cterm_load(term) * term->coefficient;
+  }
+  return res;
+}
+
+static void compile_expr(Closure *closure, CExpr *cexpr, Expr *expr);
+
+// Operands were bound by `interpreter_init`
+static void compile_term(Closure *closure, CTerm *term, Operand *operand) {
+  memset(term, 0, sizeof(CTerm));
+  term->coefficient = 1;
+  if (operand->typ == OPERAND_INT_VAR) {
+    term->ref = operand->ref;
+    return;
+  }
+  term->base = operand->ref; // Any width, they share the union
+  term->width = operand->width;
+  term->idx = closure_alloc(closure, sizeof(CExpr));
+  compile_expr(closure, term->idx, &operand->idx_expr);
+}
+
+static void compile_expr(Closure *closure, CExpr *cexpr, Expr *expr) {
+  memset(cexpr, 0, sizeof(CExpr));
+  cexpr->constant = expr->constant;
+  usize cnts = expr->op_terms.item_cnts;
+  OperandTerm *op_terms = expr->op_terms.items;
+  int int_only = 1;
+  for (int i = 0; i < cnts; i++) {
+    int_only &= op_terms[i].operand.typ == OPERAND_INT_VAR;
+  }
+#ifndef NO_DEBUG
+  closure->stats.exprs++;
+  closure->stats.specialized += int_only && cnts <= 2;
+#endif
+  if (int_only && cnts <= 2) {
+    static const CExprFn fns[] = {ce_const, ce_int_coef, ce_int2};
+    cexpr->fn = fns[cnts];
+    if (cnts >= 1) {
+      cexpr->a = op_terms[0].operand.ref;
+      cexpr->coef_a = op_terms[0].coefficient;
+    }
+    if (cnts == 2) {
+      cexpr->b = op_terms[1].operand.ref;
+      cexpr->coef_b = op_terms[1].coefficient;
+    }
+    if (cnts == 1 && cexpr->coef_a == 1) {
+      cexpr->fn = ce_int;
+    }
+    return;
+  }
+  cexpr->fn = int_only ? ce_linear : ce_general;
+  cexpr->term_cnts = cnts;
+  cexpr->terms = closure_alloc(closure, cnts * sizeof(CTerm));
+  for (int i = 0; i < cnts; i++) {
+    compile_term(closure, &cexpr->terms[i], &op_terms[i].operand);
+    cexpr->terms[i].coefficient = op_terms[i].coefficient;
+  }
+}
+
+// Bare `x`
+static int is_bare_int(CExpr *cexpr) {
+  return cexpr->fn == ce_int && cexpr->constant == 0;
+}
+
+/* Conditions */
+
+static char cc_generic(const CCond *cond) {
+  int left = cond->left.fn(&cond->left);
+  int right = cond->right.fn(&cond->right);
+  return do_cmp(cond->typ, left, right);
+}
+
+#define DEF_COND_FNS(name, op)                                                 \
+  static char cc_var_const_##name(const CCond *cond) {                         \
+    return *cond->left.a op cond->right.constant;                              \
+  }                                                                            \
+  static char cc_var_var_##name(const CCond *cond) {                           \
+    return *cond->left.a op(*cond->right.a);                                   \
+  }
+
+DEF_COND_FNS(lt, <)
+DEF_COND_FNS(eq, ==)
+DEF_COND_FNS(le, <=)
+DEF_COND_FNS(gt, >)
+DEF_COND_FNS(neq, !=)
+DEF_COND_FNS(ge, >=)
+#undef DEF_COND_FNS
+
+static const CCondFn var_const_conds[] = {
+    [CMP_LT] = cc_var_const_lt, [CMP_EQ] = cc_var_const_eq,
+    [CMP_LE] = cc_var_const_le, [CMP_GT] = cc_var_const_gt,
+    [CMP_NEQ] = cc_var_const_neq, [CMP_GE] = cc_var_const_ge,
+};
+
+static const CCondFn var_var_conds[] = {
+    [CMP_LT] = cc_var_var_lt, [CMP_EQ] = cc_var_var_eq,
+    [CMP_LE] = cc_var_var_le, [CMP_GT] = cc_var_var_gt,
+    [CMP_NEQ] = cc_var_var_neq, [CMP_GE] = cc_var_var_ge,
+};
+
+static void compile_cond(Closure *closure, CCond *ccond, Cond *cond) {
+  ccond->typ = cond->typ;
+  compile_expr(closure, &ccond->left, &cond->left);
+  compile_expr(closure, &ccond->right, &cond->right);
+  ccond->fn = cc_generic;
+  if (is_bare_int(&ccond->left) && ccond->right.fn == ce_const) {
+    ccond->fn = var_const_conds[cond->typ];
+  } else if (is_bare_int(&ccond->left) && is_bare_int(&ccond->right)) {
+    ccond->fn = var_var_conds[cond->typ];
+  }
+}
+
+/* Statements */
+
+static inline void run_block(const CBlock *block) {
+  const CStmt *stmt = block->stmts;
+  for (usize i = 0; i < block->cnts; i++, stmt++) {
+    stmt->fn(stmt);
+  }
+}
+
+static void cs_set_int(const CStmt *stmt) {
+  const struct CSetStmt *set = &stmt->inner.set;
+  *set->dst.ref = set->val.fn(&set->val);
+}
+
+static void cs_set_int_const(const CStmt *stmt) {
+  *stmt->inner.set.dst.ref = stmt->inner.set.val.constant;
+}
+
+// `:set x, x + const`
+static void cs_inc_int(const CStmt *stmt) {
+  *stmt->inner.set.dst.ref += stmt->inner.set.val.constant;
+}
+
+static void cs_set_arr(const CStmt *stmt) {
+  const struct CSetStmt *set = &stmt->inner.set;
+  int res = set->val.fn(&set->val);
+  cterm_store(&set->dst, res);
+}
+
+static void cs_yosoro(const CStmt *stmt) {
+  print_num(stmt->inner.yosoro.fn(&stmt->inner.yosoro));
+}
+
+static void cs_ihu(const CStmt *stmt) {
+  const struct CCondStmt *ihu = &stmt->inner.cond_blk;
+  if (ihu->cond.fn(&ihu->cond)) {
+    run_block(&ihu->body);
+  }
+}
+
+static void cs_while(const CStmt *stmt) {
+  const struct CCondStmt *while_stmt = &stmt->inner.cond_blk;
+  while (while_stmt->cond.fn(&while_stmt->cond)) {
+    run_block(&while_stmt->body);
+  }
+}
+
+static void cs_hor_int(const CStmt *stmt) {
+  const struct CHorStmt *hor = &stmt->inner.hor;
+  int start = hor->start.fn(&hor->start);
+  int end = hor->end.fn(&hor->end);
+  int *var = hor->var.ref;
+  for (int i = start; i <= end; i++) {
+    *var = i;
+    run_block(&hor->body);
+  }
+}
+
+static void cs_hor(const CStmt *stmt) {
+  const struct CHorStmt *hor = &stmt->inner.hor;
+  int start = hor->start.fn(&hor->start);
+  int end = hor->end.fn(&hor->end);
+  for (int i = start; i <= end; i++) {
+    cterm_store(&hor->var, i);
+    run_block(&hor->body);
+  }
+}
+
+static void cs_fallback(const CStmt *stmt) {
+  const struct CFallbackStmt *fallback = &stmt->inner.fallback;
+  execute_stmt(fallback->interpreter, fallback->stmt);
+}
+
+static void compile_block(Closure *closure, CBlock *block, DynArr *stmts);
+
+static void compile_set(Closure *closure, CStmt *cstmt, SetStmt *set) {
+  struct CSetStmt *cset = &cstmt->inner.set;
+  compile_term(closure, &cset->dst, &set->operand);
+  compile_expr(closure, &cset->val, &set->expr);
+  if (!cset->dst.ref) {
+    cstmt->fn = cs_set_arr;
+    return;
+  }
+#ifndef NO_DEBUG
+  closure->stats.specialized +=
+      cset->val.fn == ce_const || cset->val.fn == ce_int;
+#endif
+  if (cset->val.fn == ce_const) {
+    cstmt->fn = cs_set_int_const;
+  } else if (cset->val.fn == ce_int && cset->val.a == cset->dst.ref) {
+    cstmt->fn = cs_inc_int;
+  } else {
+    cstmt->fn = cs_set_int;
+  }
+}
+
+static void compile_stmt(Closure *closure, CStmt *cstmt, Stmt *stmt) {
+  union CStmtInner *inner = &cstmt->inner;
+  memset(cstmt, 0, sizeof(CStmt));
+#ifndef NO_DEBUG
+  closure->stats.stmts++;
+#endif
+  switch (stmt->typ) {
+  case STMT_IHU_BLK:
+    cstmt->fn = cs_ihu;
+    compile_cond(closure, &inner->cond_blk.cond, &stmt->inner.ihu.cond);
+    compile_block(closure, &inner->cond_blk.body, &stmt->inner.ihu.stmts);
+    break;
+  case STMT_WHILE_BLK:
+    cstmt->fn = cs_while;
+    compile_cond(closure, &inner->cond_blk.cond,
+                 &stmt->inner.while_stmt.cond);
+    compile_block(closure, &inner->cond_blk.body,
+                  &stmt->inner.while_stmt.stmts);
+    break;
+  case STMT_HOR_BLK: {
+    HorStmt *hor = &stmt->inner.hor;
+    compile_term(closure, &inner->hor.var, &hor->var);
+    compile_expr(closure, &inner->hor.start, &hor->start);
+    compile_expr(closure, &inner->hor.end, &hor->end);
+    compile_block(closure, &inner->hor.body, &hor->stmts);
+    cstmt->fn = inner->hor.var.ref ? cs_hor_int : cs_hor;
+  } break;
+  case STMT_YOSORO_CMD:
+    cstmt->fn = cs_yosoro;
+    compile_expr(closure, &inner->yosoro, &stmt->inner.yosoro.expr);
+    break;
+  case STMT_SET_CMD:
+    compile_set(closure, cstmt, &stmt->inner.set);
+    break;
+  case STMT_BULK_LOOP:
+    cstmt->fn = cs_fallback;
+    inner->fallback.interpreter = &closure->interpreter;
+    inner->fallback.stmt = stmt;
+#ifndef NO_DEBUG
+    closure->stats.fallback++;
+#endif
+    break;
+  }
+}
+
+static void compile_block(Closure *closure, CBlock *block, DynArr *stmts) {
+  block->cnts = stmts->item_cnts;
+  block->stmts = closure_alloc(closure, block->cnts * sizeof(CStmt));
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    compile_stmt(closure, &block->stmts[i], stmt);
+  }
+}
+
+void closure_compile(Closure *closure) {
+  compile_block(closure, &closure->root, closure->stmts);
+}
+
+void closure_execute(Closure *closure) { run_block(&closure->root); }
+
+#ifndef NO_DEBUG
+void closure_stats(Closure *closure) {
+  struct ClosureStats stats = closure->stats;
+  logger("Closure Stats:\n"
+         "Nodes\n"
+         "  Stmts      : %zu\n"
+         "  Exprs      : %zu\n"
+         "  Specialized: %zu\n"
+         "  Fallback   : %zu\n",
+         stats.stmts, stats.exprs, stats.specialized, stats.fallback);
+}
+#endif
+
+#endif
+#endif
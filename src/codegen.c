@@ -1,7 +1,9 @@
 #ifdef CODEGEN
 
 #ifndef NO_STD_INC
+#include <limits.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #endif
 
@@ -14,8 +16,11 @@
 
 void cg_init(CodeGen *cg, DynArr *stmts, DynArr *var_decls) {
   da_init(&cg->codes, sizeof(OpCode), 64);
+  da_init(&cg->lin_terms, sizeof(LinTerm), 16);
   cg->stmts = stmts;
   cg->var_decls = var_decls;
+  cg->max_depth = 0;
+  da_init(&cg->stmt_starts, sizeof(usize), 64);
 }
 
 CodeGen *cg_create(DynArr *stmts, DynArr *var_decls) {
@@ -24,19 +29,23 @@ CodeGen *cg_create(DynArr *stmts, DynArr *var_decls) {
   return cg;
 }
 
-void cg_free(CodeGen *cg) { da_free(&cg->codes); }
+void cg_free(CodeGen *cg) {
+  da_free(&cg->codes);
+  da_free(&cg->lin_terms);
+  da_free(&cg->stmt_starts);
+}
 
 usize gen_load_const(CodeGen *cg, int constant) {
   OpCode *constant_op = da_try_push_back(&cg->codes);
   constant_op->typ = OP_LOAD_CONST;
-  constant_op->data.constant = constant;
+  constant_op->imm = constant;
   return cg->codes.item_cnts - 1;
 }
 
 usize gen_cmul(CodeGen *cg, int constant) {
   OpCode *constant_op = da_try_push_back(&cg->codes);
   constant_op->typ = OP_CMUL;
-  constant_op->data.constant = constant;
+  constant_op->imm = constant;
   return cg->codes.item_cnts - 1;
 }
 
@@ -78,10 +87,10 @@ usize gen_put(CodeGen *cg) {
   return cg->codes.item_cnts - 1;
 }
 
-usize gen_jmp(CodeGen *cg, short offset) {
+usize gen_jmp(CodeGen *cg, int offset) {
   OpCode *jmp_op = da_try_push_back(&cg->codes);
   jmp_op->typ = OP_JMP;
-  jmp_op->data.offset = offset;
+  jmp_op->imm = offset;
   return cg->codes.item_cnts - 1;
 }
 
@@ -102,7 +111,7 @@ usize gen_jmp(CodeGen *cg, short offset) {
 usize gen_incr(CodeGen *cg, int constant) {
   OpCode *incr_op = da_try_push_back(&cg->codes);
   incr_op->typ = OP_INCR;
-  incr_op->data.constant = constant;
+  incr_op->imm = constant;
   return cg->codes.item_cnts - 1;
 }
 
@@ -115,11 +124,20 @@ cmp_type reverse_cmp_typ(cmp_type cmp_typ) {
   return cmp_typ ^ 0b111;
 }
 
-usize gen_cjmp(CodeGen *cg, cmp_type cmp_typ, short offset) {
+usize gen_cjmp(CodeGen *cg, cmp_type cmp_typ, int offset) {
   OpCode *cjmp_op = da_try_push_back(&cg->codes);
   cjmp_op->typ = OP_CJMP;
-  cjmp_op->data.cjmp.cmp_typ = cmp_typ;
-  cjmp_op->data.cjmp.offset = offset;
+  cjmp_op->slot = cmp_typ;
+  cjmp_op->imm = offset;
+  return cg->codes.item_cnts - 1;
+}
+
+// FOR_INIT or FOR_NEXT over the int var `decl_idx`
+usize gen_for(CodeGen *cg, enum OpCodeType typ, int decl_idx, int offset) {
+  OpCode *for_op = da_try_push_back(&cg->codes);
+  for_op->typ = typ;
+  for_op->slot = decl_idx;
+  for_op->imm = offset;
   return cg->codes.item_cnts - 1;
 }
 
@@ -131,73 +149,151 @@ usize gen_halt(CodeGen *cg) {
 
 void gen_expr(CodeGen *cg, Expr *expr);
 
+#ifdef CHECKED
+// [idx] -> [idx], unless the bounds pass cleared the access
+static void gen_check(CodeGen *cg, Operand *operand) {
+  if (operand->unchecked) {
+    return;
+  }
+  OpCode *check_op = da_try_push_back(&cg->codes);
+  check_op->typ = OP_CHECK;
+  check_op->slot = operand->decl_idx;
+}
+
+// Preheader checks, before the loop variable is first stored
+static void gen_bounds_hoists(CodeGen *cg, HorStmt *hor) {
+  if (!hor->hoists) {
+    return;
+  }
+  BoundsHoist *hoist = hor->hoists->items;
+  for (int i = 0; i < hor->hoists->item_cnts; i++, hoist++) {
+    gen_expr(cg, &hor->start);
+    gen_expr(cg, &hor->end);
+    gen_expr(cg, &hoist->rest);
+    OpCode *bounds_op = da_try_push_back(&cg->codes);
+    bounds_op->typ = OP_BOUNDS;
+    bounds_op->slot = hoist->decl_idx;
+    bounds_op->imm = hoist->coefficient;
+  }
+}
+#endif
+
+// Per element width of the array
+static enum OpCodeType arr_op_typ(VarDecl *decl, int store) {
+  switch (decl->data.a.width) {
+  case ELEM_I16:
+    return store ? OP_STORE_ARR16 : OP_LOAD_ARR16;
+  case ELEM_I8:
+    return store ? OP_STORE_ARR8 : OP_LOAD_ARR8;
+  default:
+    return store ? OP_STORE_ARR : OP_LOAD_ARR;
+  }
+}
+
 void gen_load_operand(CodeGen *cg, Operand *operand) {
   switch (operand->typ) {
   case OPERAND_INT_VAR: {
     OpCode *int_op = da_try_push_back(&cg->codes);
-    int_op->data.ptr = (VarDecl *)(cg->var_decls->items) + operand->decl_idx;
-    // int_op->data.decl_idx = operand->decl_idx;
+    int_op->slot = operand->decl_idx;
     int_op->typ = OP_LOAD_INT;
   } break;
   case OPERAND_ARR_ELEM: {
     // Load Idx
     gen_expr(cg, &operand->idx_expr);
+#ifdef CHECKED
+    gen_check(cg, operand);
+#endif
     OpCode *arr_op = da_try_push_back(&cg->codes);
-    arr_op->data.ptr = (VarDecl *)(cg->var_decls->items) + operand->decl_idx;
-    // arr_op->data.decl_idx = operand->decl_idx;
-    arr_op->typ = OP_LOAD_ARR;
+    arr_op->slot = operand->decl_idx;
+    arr_op->typ =
+        arr_op_typ((VarDecl *)(cg->var_decls->items) + operand->decl_idx, 0);
   } break;
   }
 }
 
 void gen_store_operand(CodeGen *cg, Operand *operand) {
   VarDecl *var_decl_ptr = (VarDecl *)(cg->var_decls->items) + operand->decl_idx;
-  // int var_decl_idx = operand->decl_idx;
+  int var_decl_idx = operand->decl_idx;
   switch (operand->typ) {
   case OPERAND_INT_VAR: {
     OpCode *int_op = da_try_push_back(&cg->codes);
 
     if ((cg->codes.item_cnts >= 3) && (int_op[-1].typ == OP_INCR) &&
         (int_op[-2].typ == OP_LOAD_INT) &&
-        (int_op[-2].data.ptr == var_decl_ptr
-         // int_op[-2].data.decl_idx == var_decl_idx
-         )) {
+        (int_op[-2].slot == var_decl_idx)) {
       // 特判优化
       // LOAD_I+INCR+STORE_I --> INCI
       cg->codes.item_cnts -= 2; // 缩容
       int_op[-2].typ = OP_INCI;
-      int_op[-2].data.var_const.constant = int_op[-1].data.constant;
-      int_op[-2].data.var_const.ptr = var_decl_ptr;
-      // int_op[-2].data.var_const.decl_idx = var_decl_idx;
+      int_op[-2].imm = int_op[-1].imm;
       // :WARN: 不进行清理操作...
     } else if ((cg->codes.item_cnts >= 2) &&
                (int_op[-1].typ == OP_LOAD_CONST)) {
       // 特判优化
       // LOAD_C+STORE_I --> SETI
       cg->codes.item_cnts -= 1; // 缩容
-      int constant = int_op[-1].data.constant;
       int_op[-1].typ = OP_SETI;
-      int_op[-1].data.var_const.constant = constant;
-      int_op[-1].data.var_const.ptr = var_decl_ptr;
-      // int_op[-1].data.var_const.decl_idx = var_decl_idx;
+      int_op[-1].slot = var_decl_idx;
       // :WARN: 不进行清理操作...
     } else {
-      int_op->data.ptr = var_decl_ptr;
-      // int_op->data.decl_idx = var_decl_idx;
+      int_op->slot = var_decl_idx;
       int_op->typ = OP_STORE_INT;
     }
   } break;
   case OPERAND_ARR_ELEM: {
     // Load Idx
     gen_expr(cg, &operand->idx_expr);
+#ifdef CHECKED
+    gen_check(cg, operand);
+#endif
     OpCode *arr_op = da_try_push_back(&cg->codes);
-    arr_op->data.ptr = var_decl_ptr;
-    // arr_op->data.decl_idx = var_decl_idx;
-    arr_op->typ = OP_STORE_ARR;
+    arr_op->slot = var_decl_idx;
+    arr_op->typ = arr_op_typ(var_decl_ptr, 1);
   } break;
   }
 }
 
+// The int terms and the constant in one LINCOMB, then each element as
+// before. Returns 0 with nothing emitted when there are too few int terms.
+static int gen_lincomb(CodeGen *cg, Expr *expr) {
+  OperandTerm *op_term = expr->op_terms.items;
+  int cnts = expr->op_terms.item_cnts;
+  int int_terms = 0;
+  for (int i = 0; i < cnts; i++) {
+    if (op_term[i].coefficient != 0 &&
+        op_term[i].operand.typ == OPERAND_INT_VAR) {
+      int_terms++;
+    }
+  }
+  // The table index must fit the 24-bit slot, else take the generic path
+  if (int_terms < LINCOMB_MIN_TERMS || cg->lin_terms.item_cnts >= 1u << 24) {
+    return 0;
+  }
+  OpCode *lincomb_op = da_try_push_back(&cg->codes);
+  lincomb_op->typ = OP_LINCOMB;
+  lincomb_op->slot = cg->lin_terms.item_cnts;
+  lincomb_op->imm = expr->constant;
+  *(LinTerm *)da_try_push_back(&cg->lin_terms) = (LinTerm){int_terms, 0};
+  for (int i = 0; i < cnts; i++) {
+    if (op_term[i].coefficient != 0 &&
+        op_term[i].operand.typ == OPERAND_INT_VAR) {
+      *(LinTerm *)da_try_push_back(&cg->lin_terms) =
+          (LinTerm){op_term[i].operand.decl_idx, op_term[i].coefficient};
+    }
+  }
+  for (int i = 0; i < cnts; i++) {
+    if (op_term[i].coefficient != 0 &&
+        op_term[i].operand.typ == OPERAND_ARR_ELEM) {
+      gen_load_operand(cg, &op_term[i].operand);
+      if (op_term[i].coefficient != 1) {
+        gen_cmul(cg, op_term[i].coefficient);
+      }
+      gen_adds(cg, 2);
+    }
+  }
+  return 1;
+}
+
 void gen_expr(CodeGen *cg, Expr *expr) {
   // 保证项的系数从高到低排
   OperandTerm *op_term = expr->op_terms.items;
@@ -207,6 +303,9 @@ void gen_expr(CodeGen *cg, Expr *expr) {
     gen_load_const(cg, expr->constant);
     return; // 空表达式
   }
+  if (gen_lincomb(cg, expr)) {
+    return;
+  }
 
   // 首先处理常数部分
   if (expr->constant != 0) {
@@ -233,7 +332,10 @@ void gen_expr(CodeGen *cg, Expr *expr) {
   }
 
   if (start == term_count) {
-    // 所有项的系数都是0，只有常数部分（如果存在）
+    // 所有项的系数都是0，只有常数部分（如果存在），否则仍须压入一个0
+    if (!has_constant_on_stack) {
+      gen_load_const(cg, 0);
+    }
     return;
   }
 
@@ -359,40 +461,442 @@ void gen_expr(CodeGen *cg, Expr *expr) {
 //     gen_adds(cg, stack_items);
 // }
 
-usize gen_cond(CodeGen *cg, Cond *cond, short offset) {
+// `k cmp x` as `x cmp' k`
+static cmp_type swap_cmp_typ(cmp_type cmp_typ) {
+  return (cmp_typ & 0b001) << 2 | (cmp_typ & 0b010) | cmp_typ >> 2;
+}
+
+static int is_const_expr(Expr *expr) {
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    if (op_term->coefficient != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// The operand when `expr` is exactly it, NULL otherwise
+static Operand *lone_operand(Expr *expr) {
+  Operand *operand = NULL;
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    if (op_term->coefficient == 0) {
+      continue;
+    }
+    if (operand || op_term->coefficient != 1) {
+      return NULL;
+    }
+    operand = &op_term->operand;
+  }
+  return expr->constant == 0 ? operand : NULL;
+}
+
+// The element is read without a CHECK, so only a cleared access qualifies
+static int is_lone_elem(Operand *operand) {
+  if (operand->typ != OPERAND_ARR_ELEM) {
+    return 0;
+  }
+#ifdef CHECKED
+  if (!operand->unchecked) {
+    return 0;
+  }
+#endif
+  Operand *idx = lone_operand(&operand->idx_expr);
+  return idx && idx->typ == OPERAND_INT_VAR;
+}
+
+// CJMP_VI/VV/AI and its JMP, which is the one to patch
+static usize gen_cjmp_in_place(CodeGen *cg, enum OpCodeType typ,
+                               cmp_type cmp_typ, int decl_idx, int imm,
+                               int jmp_slot, int offset) {
+  OpCode *cjmp_op = da_try_push_back(&cg->codes);
+  cjmp_op->typ = typ;
+  cjmp_op->slot = CJMP_SLOT(decl_idx, cmp_typ);
+  cjmp_op->imm = imm;
+  OpCode *jmp_op = da_try_push_back(&cg->codes);
+  jmp_op->typ = OP_JMP;
+  jmp_op->slot = jmp_slot;
+  jmp_op->imm = offset;
+  return cg->codes.item_cnts - 1;
+}
+
+// `x cmp k`, `x cmp y` and `a[x] cmp k` are compared in place, the rest
+// through the stack. Returns the jump to patch, `offset` is relative to it.
+usize gen_cond(CodeGen *cg, Cond *cond, int offset) {
+  cmp_type cmp_typ = cond->typ;
+  Expr *left = &cond->left;
+  Expr *right = &cond->right;
+  if (is_const_expr(left)) {
+    left = &cond->right;
+    right = &cond->left;
+    cmp_typ = swap_cmp_typ(cmp_typ);
+  }
+  Operand *x = lone_operand(left);
+  Operand *y = lone_operand(right);
+  if (x && x->typ == OPERAND_INT_VAR && is_const_expr(right)) {
+    return gen_cjmp_in_place(cg, OP_CJMP_VI, cmp_typ, x->decl_idx,
+                             right->constant, 0, offset);
+  }
+  if (x && x->typ == OPERAND_INT_VAR && y && y->typ == OPERAND_INT_VAR) {
+    return gen_cjmp_in_place(cg, OP_CJMP_VV, cmp_typ, x->decl_idx,
+                             y->decl_idx, 0, offset);
+  }
+  if (x && is_lone_elem(x) && is_const_expr(right)) {
+    Operand *idx = lone_operand(&x->idx_expr);
+    return gen_cjmp_in_place(cg, OP_CJMP_AI, cmp_typ, x->decl_idx,
+                             right->constant, idx->decl_idx, offset);
+  }
   gen_expr(cg, &cond->right);
   gen_expr(cg, &cond->left);
   return gen_cjmp(cg, cond->typ, offset);
 }
 
+// `[start, end, x] -> push(result)` operation
+static OpCode *gen_bulk_reduce_op(CodeGen *cg, BulkStmt *bulk, Expr *x,
+                                  enum OpCodeType typ) {
+  gen_expr(cg, &bulk->start);
+  gen_expr(cg, &bulk->end);
+  gen_expr(cg, x);
+  OpCode *reduce_op = da_try_push_back(&cg->codes);
+  reduce_op->typ = typ;
+  return reduce_op;
+}
+
+static usize gen_bulk_reduce(CodeGen *cg, BulkStmt *bulk) {
+  Operand acc = {.typ = OPERAND_INT_VAR, .decl_idx = bulk->dst_idx};
+  gen_load_operand(cg, &acc);
+  BulkSrc *src = bulk->srcs.items;
+  for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+    OpCode *suma_op = gen_bulk_reduce_op(cg, bulk, &src->offset, OP_SUMA);
+    suma_op->slot = src->decl_idx;
+    suma_op->imm = src->coefficient;
+    gen_adds(cg, 2);
+  }
+  OpCode *series_op = gen_bulk_reduce_op(cg, bulk, &bulk->val, OP_SERIES);
+  series_op->imm = bulk->stride;
+  gen_adds(cg, 2);
+  gen_store_operand(cg, &acc);
+  return cg->codes.item_cnts - 1;
+}
+
+usize gen_bulk(CodeGen *cg, BulkStmt *bulk) {
+  if (bulk->kind == BULK_REDUCE) {
+    return gen_bulk_reduce(cg, bulk);
+  }
+  // Operands are pushed in order: start, end, dst_off, [src_off], val
+  BulkSrc *src = bulk->srcs.items;
+  gen_expr(cg, &bulk->start);
+  gen_expr(cg, &bulk->end);
+  gen_expr(cg, &bulk->dst_offset);
+  if (bulk->kind == BULK_COPY) {
+    gen_expr(cg, &src->offset);
+  }
+  gen_expr(cg, &bulk->val);
+  OpCode *bulk_op = da_try_push_back(&cg->codes);
+  bulk_op->slot = bulk->dst_idx;
+  switch (bulk->kind) {
+  case BULK_FILL:
+    bulk_op->typ = OP_FILL;
+    break;
+  case BULK_IOTA:
+    bulk_op->typ = OP_IOTA;
+    bulk_op->imm = bulk->stride;
+    break;
+  case BULK_COPY:
+    bulk_op->typ = OP_COPY;
+    bulk_op->imm = src->decl_idx;
+    break;
+  case BULK_REDUCE:
+    break;
+  }
+  return cg->codes.item_cnts - 1;
+}
+
 static OpCode *get_opcode(CodeGen *cg, usize idx) {
   return (OpCode *)da_get(&cg->codes, idx);
 }
 
+// Points the JMP, CJMP or SWITCH entry at `jmp_idx` to `target`. Offsets
+// are 32-bit, anything farther is refused rather than wrapped.
+static void patch_jmp(CodeGen *cg, usize jmp_idx, usize target) {
+  long long offset = (long long)target - (long long)jmp_idx;
+  if (offset < INT_MIN || offset > INT_MAX) {
+    fprintf(stderr, "Jump from [%u] to [%u] is out of range\n", jmp_idx,
+            target);
+    exit(1);
+  }
+  get_opcode(cg, jmp_idx)->imm = offset;
+}
+
+void gen_stmts(CodeGen *cg, DynArr *stmts);
+
+static int writes_expr_operands(DynArr *stmts, Expr *expr) {
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    Operand *operand = &op_term->operand;
+    if (stmts_writes_decl(stmts, operand->decl_idx) ||
+        (operand->typ == OPERAND_ARR_ELEM &&
+         writes_expr_operands(stmts, &operand->idx_expr))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// The var of the `hor` is then its own counter, as no statement of the
+// body stores to it
+static int is_counted_hor(HorStmt *hor) {
+  Operand *var = &hor->var;
+  return var->typ == OPERAND_INT_VAR &&
+         !stmts_writes_decl(&hor->stmts, var->decl_idx);
+}
+
+// Same as the interpreter: start and end are evaluated once, before the
+// var is written. A zero-trip loop leaves the var alone, otherwise it ends
+// up equal to the end.
+static void gen_counted_hor(CodeGen *cg, HorStmt *hor) {
+  int decl_idx = hor->var.decl_idx;
+  gen_expr(cg, &hor->start);
+  gen_expr(cg, &hor->end);
+  usize try_skip = gen_for(cg, OP_FOR_INIT, decl_idx, 0);
+  usize body_start = cg->codes.item_cnts;
+  gen_stmts(cg, &hor->stmts);
+  usize try_continue = gen_for(cg, OP_FOR_NEXT, decl_idx, 0);
+  patch_jmp(cg, try_continue, body_start);
+  patch_jmp(cg, try_skip, cg->codes.item_cnts);
+}
+
+// INCA, ADDA or SETA(decl)[idx, ...] with the index of `operand`
+static void gen_elem_op(CodeGen *cg, enum OpCodeType typ, Operand *operand,
+                        int constant) {
+  gen_expr(cg, &operand->idx_expr);
+#ifdef CHECKED
+  gen_check(cg, operand);
+#endif
+  OpCode *elem_op = da_try_push_back(&cg->codes);
+  elem_op->typ = typ;
+  elem_op->slot = operand->decl_idx;
+  elem_op->imm = constant;
+}
+
+// `a[e] = k`, `a[e] = a[e] + k` and `a[e] = a[e] + rest`, where the two
+// `e` are the same expression, so it is computed once
+static int gen_update_elem(CodeGen *cg, SetStmt *set_stmt) {
+  Operand *dst = &set_stmt->operand;
+  Expr *expr = &set_stmt->expr;
+  if (is_const_expr(expr)) {
+    gen_elem_op(cg, OP_SETA, dst, expr->constant);
+    return 1;
+  }
+  OperandTerm *self = NULL;
+  int rest_terms = 0;
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    if (op_term->coefficient == 0) {
+      continue;
+    }
+    if (!self && op_term->coefficient == 1 &&
+        op_term->operand.typ == OPERAND_ARR_ELEM &&
+        op_term->operand.decl_idx == dst->decl_idx &&
+        is_expr_eq(&op_term->operand.idx_expr, &dst->idx_expr)) {
+      self = op_term;
+    } else {
+      rest_terms++;
+    }
+  }
+  if (!self) {
+    return 0;
+  }
+  if (!rest_terms) {
+    gen_elem_op(cg, OP_INCA, dst, expr->constant);
+    return 1;
+  }
+  // The rest is the expression without its own term
+  self->coefficient = 0;
+  gen_expr(cg, expr);
+  self->coefficient = 1;
+  gen_elem_op(cg, OP_ADDA, dst, 0);
+  return 1;
+}
+
+typedef struct SwitchCase {
+  int key;
+  DynArr *stmts;
+  usize jmp_idx; // Jump to be patched to the body
+} SwitchCase;
+
+// `{ ihu eq, x, key }` or `{ ihu eq, key, x }`
+static Expr *switch_case_of(Stmt *stmt, int *key) {
+  if (stmt->typ != STMT_IHU_BLK || stmt->inner.ihu.cond.typ != CMP_EQ) {
+    return NULL;
+  }
+  Cond *cond = &stmt->inner.ihu.cond;
+  Expr *x = &cond->left;
+  Expr *k = &cond->right;
+  if (x->op_terms.item_cnts == 0) {
+    x = &cond->right;
+    k = &cond->left;
+  }
+  if (x->op_terms.item_cnts == 0 || k->op_terms.item_cnts != 0) {
+    return NULL;
+  }
+  *key = k->constant;
+  return x;
+}
+
+static int compare_switch_cases(const void *a, const void *b) {
+  const SwitchCase *case_a = a;
+  const SwitchCase *case_b = b;
+  return (case_a->key > case_b->key) - (case_a->key < case_b->key);
+}
+
+// Only one case can match, as no body changes `x`
+static int collect_switch_cases(Stmt *stmts, int cnts, DynArr *cases) {
+  int key;
+  Expr *x = switch_case_of(stmts, &key);
+  if (!x) {
+    return 0;
+  }
+  for (int i = 0; i < cnts; i++) {
+    Expr *case_x = switch_case_of(&stmts[i], &key);
+    if (!case_x || !is_expr_eq(case_x, x)) {
+      break;
+    }
+    SwitchCase *sw_case = cases->items;
+    int dup = 0;
+    for (int j = 0; j < cases->item_cnts; j++, sw_case++) {
+      dup |= sw_case->key == key;
+    }
+    DynArr *body = &stmts[i].inner.ihu.stmts;
+    if (dup || writes_expr_operands(body, x)) {
+      break;
+    }
+    sw_case = da_try_push_back(cases);
+    sw_case->key = key;
+    sw_case->stmts = body;
+  }
+  return cases->item_cnts;
+}
+
+static void gen_switch_tree(CodeGen *cg, Expr *x, SwitchCase *cases,
+                            int cnts, DynArr *end_jmps) {
+  if (cnts <= SWITCH_LEAF_CASES) {
+    for (int i = 0; i < cnts; i++) {
+      gen_load_const(cg, cases[i].key);
+      gen_expr(cg, x);
+      cases[i].jmp_idx = gen_cjmp(cg, CMP_EQ, 0);
+    }
+    *(usize *)da_try_push_back(end_jmps) = gen_jmp(cg, 0);
+    return;
+  }
+  int mid = cnts / 2;
+  gen_load_const(cg, cases[mid].key);
+  gen_expr(cg, x);
+  usize try_high = gen_cjmp(cg, CMP_GE, 0);
+  gen_switch_tree(cg, x, cases, mid, end_jmps);
+  patch_jmp(cg, try_high, cg->codes.item_cnts);
+  gen_switch_tree(cg, x, cases + mid, cnts - mid, end_jmps);
+}
+
+static void gen_switch_tab(CodeGen *cg, Expr *x, SwitchCase *cases, int cnts,
+                           DynArr *end_jmps) {
+  int low = cases[0].key;
+  unsigned short tab_cnts = (unsigned)cases[cnts - 1].key - low + 1;
+  gen_expr(cg, x);
+  OpCode *switch_op = da_try_push_back(&cg->codes);
+  switch_op->typ = OP_SWITCH;
+  switch_op->slot = tab_cnts;
+  switch_op->imm = low;
+  SwitchCase *sw_case = cases;
+  for (int key = low;; key++) {
+    usize jmp_idx = gen_jmp(cg, 0);
+    if (sw_case->key == key) {
+      (sw_case++)->jmp_idx = jmp_idx;
+    } else {
+      *(usize *)da_try_push_back(end_jmps) = jmp_idx; // Hole
+    }
+    if (key == cases[cnts - 1].key) {
+      break;
+    }
+  }
+  *(usize *)da_try_push_back(end_jmps) = gen_jmp(cg, 0); // Out of range
+}
+
+// Lowers the run of `ihu` blocks at `stmts`, returns its length
+static int gen_switch(CodeGen *cg, Stmt *stmts, int cnts) {
+  DynArr cases;
+  da_init(&cases, sizeof(SwitchCase), 16);
+  int case_cnts = collect_switch_cases(stmts, cnts, &cases);
+  if (case_cnts < SWITCH_MIN_CASES) {
+    da_free(&cases);
+    return 0;
+  }
+  int key;
+  Expr *x = switch_case_of(stmts, &key);
+  SwitchCase *sorted = cases.items;
+  qsort(sorted, case_cnts, sizeof(SwitchCase), compare_switch_cases);
+  DynArr end_jmps;
+  da_init(&end_jmps, sizeof(usize), 4);
+  long long tab_cnts = (long long)sorted[case_cnts - 1].key - sorted[0].key + 1;
+  if (tab_cnts <= SWITCH_MAX_TAB && tab_cnts <= 2ll * case_cnts) {
+    gen_switch_tab(cg, x, sorted, case_cnts, &end_jmps);
+  } else {
+    gen_switch_tree(cg, x, sorted, case_cnts, &end_jmps);
+  }
+  for (int i = 0; i < case_cnts; i++) {
+    usize body_start = cg->codes.item_cnts;
+    patch_jmp(cg, sorted[i].jmp_idx, body_start);
+    gen_stmts(cg, sorted[i].stmts);
+    if (i + 1 < case_cnts) {
+      *(usize *)da_try_push_back(&end_jmps) = gen_jmp(cg, 0);
+    }
+  }
+  usize *end_jmp = end_jmps.items;
+  for (int i = 0; i < end_jmps.item_cnts; i++, end_jmp++) {
+    patch_jmp(cg, *end_jmp, cg->codes.item_cnts);
+  }
+  da_free(&end_jmps);
+  da_free(&cases);
+  return case_cnts;
+}
+
 void gen_stmts(CodeGen *cg, DynArr *stmts) {
   Stmt *stmt_ptr = stmts->items;
   for (int i = 0; i < stmts->item_cnts; i++, stmt_ptr++) {
+    *(usize *)da_try_push_back(&cg->stmt_starts) = cg->codes.item_cnts;
     switch (stmt_ptr->typ) {
     case STMT_IHU_BLK: {
+      int run_cnts = gen_switch(cg, stmt_ptr, stmts->item_cnts - i);
+      if (run_cnts) {
+        i += run_cnts - 1;
+        stmt_ptr += run_cnts - 1;
+        break;
+      }
       IhuStmt *ihu_stmt = &stmt_ptr->inner.ihu;
       ihu_stmt->cond.typ = reverse_cmp_typ(ihu_stmt->cond.typ);
       usize try_skip = gen_cond(cg, &ihu_stmt->cond, 0);
       gen_stmts(cg, &ihu_stmt->stmts);
-      get_opcode(cg, try_skip)->data.cjmp.offset =
-          cg->codes.item_cnts - try_skip; // avoid use after free
+      patch_jmp(cg, try_skip, cg->codes.item_cnts); // avoid use after free
     } break;
     case STMT_WHILE_BLK: {
       WhileStmt *while_stmt = &stmt_ptr->inner.while_stmt;
       usize jmp_cond = gen_jmp(cg, 0);
       gen_stmts(cg, &while_stmt->stmts);
-      int stmts_end = cg->codes.item_cnts;
+      usize stmts_end = cg->codes.item_cnts;
       usize try_continue = gen_cond(cg, &while_stmt->cond, 0);
-      get_opcode(cg, try_continue)->data.cjmp.offset =
-          jmp_cond - try_continue + 1;
-      get_opcode(cg, jmp_cond)->data.offset = stmts_end - jmp_cond;
+      patch_jmp(cg, try_continue, jmp_cond + 1);
+      patch_jmp(cg, jmp_cond, stmts_end);
     } break;
     case STMT_HOR_BLK: {
       HorStmt *hor_stmt = &stmt_ptr->inner.hor;
+#ifdef CHECKED
+      gen_bounds_hoists(cg, hor_stmt);
+#endif
+      if (is_counted_hor(hor_stmt)) {
+        gen_counted_hor(cg, hor_stmt);
+        break;
+      }
       gen_expr(cg, &hor_stmt->start);
       gen_store_operand(cg, &hor_stmt->var);
       usize try_skip = gen_jmp(cg, 0);
@@ -400,13 +904,12 @@ void gen_stmts(CodeGen *cg, DynArr *stmts) {
       gen_load_operand(cg, &hor_stmt->var);
       gen_incr(cg, 1);
       gen_store_operand(cg, &hor_stmt->var);
-      int stmts_end = cg->codes.item_cnts;
+      usize stmts_end = cg->codes.item_cnts;
       gen_expr(cg, &hor_stmt->end);
       gen_load_operand(cg, &hor_stmt->var);
       usize try_continue = gen_cjmp(cg, CMP_LE, 0);
-      get_opcode(cg, try_continue)->data.cjmp.offset =
-          try_skip - try_continue + 1;
-      get_opcode(cg, try_skip)->data.offset = stmts_end - try_skip;
+      patch_jmp(cg, try_continue, try_skip + 1);
+      patch_jmp(cg, try_skip, stmts_end);
       gen_expr(cg, &hor_stmt->end);
       gen_store_operand(cg, &hor_stmt->var);
     } break;
@@ -420,25 +923,126 @@ void gen_stmts(CodeGen *cg, DynArr *stmts) {
       SetStmt *set_stmt = &stmt_ptr->inner.set;
       Expr *expr = &set_stmt->expr;
       OperandTerm *op_term_ptr = expr->op_terms.items;
+      if (set_stmt->operand.typ == OPERAND_ARR_ELEM &&
+          gen_update_elem(cg, set_stmt)) {
+        break;
+      }
       gen_expr(cg, &set_stmt->expr);
       gen_store_operand(cg, &set_stmt->operand);
       break;
     }
+    case STMT_BULK_LOOP: {
+      BulkStmt *bulk_stmt = &stmt_ptr->inner.bulk;
+      // A zero-trip loop leaves the var alone, as FOR_INIT does
+      gen_expr(cg, &bulk_stmt->end);
+      gen_expr(cg, &bulk_stmt->start);
+      usize try_skip = gen_cjmp(cg, CMP_GT, 0);
+      gen_bulk(cg, bulk_stmt);
+      gen_expr(cg, &bulk_stmt->end);
+      gen_store_operand(cg, &bulk_stmt->var);
+      patch_jmp(cg, try_skip, cg->codes.item_cnts);
+    } break;
+    }
+  }
+  *(usize *)da_try_push_back(&cg->stmt_starts) = cg->codes.item_cnts;
+}
+
+static void visit_depth(DynArr *work, int *depths, usize idx, int depth) {
+  if (depths[idx] < 0) {
+    depths[idx] = depth;
+    *(usize *)da_try_push_back(work) = idx;
+  } else if (depths[idx] != depth) {
+    fprintf(stderr, "Stack depth at [%u] is both %d and %d\n", idx,
+            depths[idx], depth);
+    exit(1);
+  }
+}
+
+// Depth of the operand stack before each instruction, -1 if unreachable.
+// Deltas are fixed per opcode, so every path must reach an instruction
+// with the same depth, or the generated code is broken.
+static int *compute_stack_depths(CodeGen *cg) {
+  usize code_cnts = cg->codes.item_cnts;
+  OpCode *codes = cg->codes.items;
+  int *depths = malloc(code_cnts * sizeof(int));
+  for (usize i = 0; i < code_cnts; i++) {
+    depths[i] = -1;
+  }
+  DynArr work; // usize
+  da_init(&work, sizeof(usize), 64);
+  visit_depth(&work, depths, 0, 0);
+  while (work.item_cnts) {
+    usize idx = ((usize *)work.items)[--work.item_cnts];
+    OpCode *code = &codes[idx];
+    int depth = depths[idx] - get_stack_delta(code->typ);
+    if (depth < 0) {
+      fprintf(stderr, "Stack underflow at [%u]\n", idx);
+      exit(1);
+    }
+    if (depth > cg->max_depth) {
+      cg->max_depth = depth;
+    }
+    switch (code->typ) {
+    case OP_HALT:
+      break;
+    case OP_JMP:
+      visit_depth(&work, depths, idx + code->imm, depth);
+      break;
+    case OP_CJMP:
+    case OP_FOR_INIT:
+    case OP_FOR_NEXT:
+      visit_depth(&work, depths, idx + code->imm, depth);
+      visit_depth(&work, depths, idx + 1, depth);
+      break;
+    case OP_CJMP_VI:
+    case OP_CJMP_VV:
+    case OP_CJMP_AI:
+      visit_depth(&work, depths, idx + 1 + code[1].imm, depth);
+      visit_depth(&work, depths, idx + 2, depth);
+      break;
+    case OP_SWITCH:
+      for (usize i = 1; i <= code->slot + 1; i++) {
+        visit_depth(&work, depths, idx + i, depth);
+      }
+      break;
+    default:
+      visit_depth(&work, depths, idx + 1, depth);
+      break;
+    }
+  }
+  da_free(&work);
+  // Statements hand each other an empty stack, which the TOS cache relies on
+  usize *stmt_start = cg->stmt_starts.items;
+  for (usize i = 0; i < cg->stmt_starts.item_cnts; i++, stmt_start++) {
+    if (*stmt_start < code_cnts && depths[*stmt_start] > 0) {
+      fprintf(stderr, "Stack depth at statement [%u] is %d\n", *stmt_start,
+              depths[*stmt_start]);
+      exit(1);
     }
   }
+  return depths;
 }
 
-void compute_stack_deltas(DynArr *codes) {
-  OpCode *code_ptr = codes->items;
-  for (int i = 0; i < codes->item_cnts; i++, code_ptr++) {
-    code_ptr->stack_delta = get_stack_delta(code_ptr->typ);
+// The first push of an expression has no cached top to spill
+static void specialize_empty_pushes(CodeGen *cg, int *depths) {
+  OpCode *code_ptr = cg->codes.items;
+  for (int i = 0; i < cg->codes.item_cnts; i++, code_ptr++) {
+    if (depths[i] == 0 && code_ptr->typ == OP_LOAD_CONST) {
+      code_ptr->typ = OP_LOAD_CONST_E;
+    } else if (depths[i] == 0 && code_ptr->typ == OP_LOAD_INT) {
+      code_ptr->typ = OP_LOAD_INT_E;
+    } else if (depths[i] == 0 && code_ptr->typ == OP_LINCOMB) {
+      code_ptr->typ = OP_LINCOMB_E;
+    }
   }
 }
 
 void cg_gen(CodeGen *cg) {
   gen_stmts(cg, cg->stmts);
   gen_halt(cg);
-  compute_stack_deltas(&cg->codes);
+  int *depths = compute_stack_depths(cg);
+  specialize_empty_pushes(cg, depths);
+  free(depths);
 }
 
 #ifndef NO_DEBUG
@@ -471,34 +1075,65 @@ void cg_debug(CodeGen *cg) {
     printf("[%d] = %s(", i, op_code_type(code_ptr->typ));
     switch (code_ptr->typ) {
     case OP_LOAD_CONST:
+    case OP_LOAD_CONST_E:
     case OP_CMUL:
     case OP_INCR:
-      printf("const: %d", code_ptr->data.constant);
+    case OP_SERIES:
+      printf("const: %d", code_ptr->imm);
       break;
     case OP_LOAD_INT:
+    case OP_LOAD_INT_E:
     case OP_LOAD_ARR:
     case OP_STORE_INT:
-    case OP_STORE_ARR: {
-      VarDecl *decl_ptr = code_ptr->data.ptr;
-      printf("ptr: %p(#%hd)", decl_ptr, decl_ptr->decl_idx);
-      // printf("decl_idx: #%hu", code_ptr->data.decl_idx);
-    } break;
+    case OP_STORE_ARR:
+    case OP_LOAD_ARR16:
+    case OP_LOAD_ARR8:
+    case OP_STORE_ARR16:
+    case OP_STORE_ARR8:
+    case OP_FILL:
+    case OP_CHECK:
+    case OP_ADDA:
+      printf("decl_idx: #%u", code_ptr->slot);
+      break;
     case OP_JMP:
-      printf("offset: %hd", code_ptr->data.offset);
+      printf("offset: %d", code_ptr->imm);
+      break;
+    case OP_SWITCH:
+      printf("low: %d, cnts: %u", code_ptr->imm, code_ptr->slot);
       break;
     case OP_CJMP:
-      printf("cmp_typ: \"%s\"(%d), offset: %hd",
-             stringfy_cmp_typ(code_ptr->data.cjmp.cmp_typ),
-             code_ptr->data.cjmp.cmp_typ, code_ptr->data.cjmp.offset);
+      printf("cmp_typ: \"%s\"(%u), offset: %d",
+             stringfy_cmp_typ(code_ptr->slot), code_ptr->slot, code_ptr->imm);
       break;
     case OP_SETI:
-    case OP_INCI: {
-      VarDecl *decl_ptr = code_ptr->data.var_const.ptr;
-      printf("ptr: %p(#%hd), const: %d", decl_ptr, decl_ptr->decl_idx,
-             code_ptr->data.var_const.constant);
-      // printf("decl_idx: #%hu, const: %d", code_ptr->data.decl_idx,
-      //        code_ptr->data.var_const.constant);
-    } break;
+    case OP_INCI:
+    case OP_INCA:
+    case OP_SETA:
+    case OP_IOTA:
+    case OP_COPY:
+    case OP_SUMA:
+    case OP_BOUNDS:
+      printf("decl_idx: #%u, const: %d", code_ptr->slot, code_ptr->imm);
+      break;
+    case OP_FOR_INIT:
+    case OP_FOR_NEXT:
+      printf("decl_idx: #%u, offset: %d", code_ptr->slot, code_ptr->imm);
+      break;
+    case OP_CJMP_VI:
+      printf("cmp_typ: \"%s\", decl_idx: #%u, const: %d",
+             stringfy_cmp_typ(CJMP_SLOT_CMP(code_ptr->slot)),
+             CJMP_SLOT_DECL(code_ptr->slot), code_ptr->imm);
+      break;
+    case OP_CJMP_VV:
+      printf("cmp_typ: \"%s\", decl_idx: #%u, #%d",
+             stringfy_cmp_typ(CJMP_SLOT_CMP(code_ptr->slot)),
+             CJMP_SLOT_DECL(code_ptr->slot), code_ptr->imm);
+      break;
+    case OP_CJMP_AI:
+      printf("cmp_typ: \"%s\", decl_idx: #%u[#%u], const: %d",
+             stringfy_cmp_typ(CJMP_SLOT_CMP(code_ptr->slot)),
+             CJMP_SLOT_DECL(code_ptr->slot), code_ptr[1].slot, code_ptr->imm);
+      break;
     // case OP_CMP:
     //   printf("cmp_typ: %s",
     //          debug_token_type(code_ptr->data.cmp_typ + TOK_CMP_LT - 1));
@@ -506,6 +1141,14 @@ void cg_debug(CodeGen *cg) {
     // case OP_ADDS:
     //   printf("term_cnts: %d", code_ptr->data.term_cnts);
     //   break;
+    case OP_LINCOMB:
+    case OP_LINCOMB_E: {
+      LinTerm *term = (LinTerm *)cg->lin_terms.items + code_ptr->slot;
+      printf("const: %d, terms:", code_ptr->imm);
+      for (unsigned j = 1; j <= term->decl; j++) {
+        printf(" %d*#%u", term[j].coef, term[j].decl);
+      }
+    } break;
     case OP_BINADD:
     // case OP_TRIADD:
     // case OP_QUADADD:
@@ -515,6 +1158,7 @@ void cg_debug(CodeGen *cg) {
     }
     puts(")");
   }
+  printf("Max stack depth: %d\n", cg->max_depth);
 }
 #endif
 
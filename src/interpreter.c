@@ -1,11 +1,18 @@
-#ifndef CODEGEN
+#if !defined(CODEGEN) || defined(PROFILE)
 
 #ifndef NO_CUSTOM_INC
 #include "interpreter.h"
+#include "kernels.h"
 #include "parser.h"
 #include "utils.h"
 #endif
 
+#ifdef CHECKED
+#ifndef NO_CUSTOM_INC
+#include "bounds.h"
+#endif
+#endif
+
 #ifndef NO_STD_INC
 #include <stddef.h>
 #include <stdint.h>
@@ -52,6 +59,7 @@ void interpreter_init(Interpreter *interpreter, DynArr *stmts,
   // interpreter->exec_ptr = 0;
   // var_decls_init_data(var_decls);
   interpreter->var_decls = var_decls;
+  bind_stmts(stmts, var_decls);
 }
 
 Interpreter *interpreter_create(DynArr *stmts, DynArr *var_decls) {
@@ -62,53 +70,104 @@ Interpreter *interpreter_create(DynArr *stmts, DynArr *var_decls) {
 
 void interpreter_free(Interpreter *interpreter) {
   // var_decls_free_data(interpreter->var_decls);
+  if (interpreter->flats.items) {
+    da_free(&interpreter->flats);
+    da_free(&interpreter->frames);
+#ifdef PROFILE
+    profiler_free(&interpreter->profiler);
+#endif
+  }
 }
 
 int eval_expr(Interpreter *interpreter, Expr *expr);
 
-__attribute__((noinline)) // Keep it noinline
-static int compute_array_index(Interpreter *interpreter, Expr *idx_expr,
-                               int start) {
-  int idx_res = eval_expr(interpreter, idx_expr);
-  // if (idx_res > decl->end || idx_res < decl->start) {
-  //   err_log("Index(%d) of Array(#%zu) is Out of Bounds (in %s)\n", idx_res,
-  //           operand->decl_idx, __FUNCTION__);
-  // }
-  return idx_res - start;
+static inline VarDecl *interpreter_decl(Interpreter *interpreter,
+                                        unsigned short decl_idx) {
+  return (VarDecl *)(interpreter->var_decls->items) + decl_idx;
 }
 
-int *operand_get_ref(Interpreter *interpreter, Operand *operand) {
-  VarDecl *decl =
-      (VarDecl *)(interpreter->var_decls->items) + operand->decl_idx;
-  if (operand->typ == OPERAND_INT_VAR) {
-    return &decl->data.i.val;
+// Of an array element, `ref` is biased by the array start
+static inline int operand_idx(Interpreter *interpreter, Operand *operand) {
+  int idx = eval_expr(interpreter, &operand->idx_expr);
+#ifdef CHECKED
+  if (!operand->unchecked) {
+    bounds_check(interpreter_decl(interpreter, operand->decl_idx), idx);
   }
-  // else OPERAND_ARR_ELEM
-  int idx = compute_array_index(interpreter, &operand->idx_expr, decl->start);
-  return &decl->data.a.arr[idx];
+#endif
+  return idx;
 }
 
 void operand_write(Interpreter *interpreter, Operand *operand, int data) {
 #ifndef NO_DEBUG
   interpreter->stats.operand_write++;
 #endif
-  *operand_get_ref(interpreter, operand) = data;
+  if (operand->typ == OPERAND_INT_VAR) {
+    *operand->ref = data;
+    return;
+  }
+  int idx = operand_idx(interpreter, operand);
+  // Narrowed arrays only ever get values that fit
+  if (operand->width == ELEM_I32) {
+    operand->ref[idx] = data;
+  } else if (operand->width == ELEM_I16) {
+    operand->ref16[idx] = data;
+  } else {
+    operand->ref8[idx] = data;
+  }
 }
 
 int operand_read(Interpreter *interpreter, Operand *operand) {
 #ifndef NO_DEBUG
   interpreter->stats.operand_read++;
 #endif
-  return *operand_get_ref(interpreter, operand);
+  if (operand->typ == OPERAND_INT_VAR) {
+    return *operand->ref;
+  }
+  int idx = operand_idx(interpreter, operand);
+  if (operand->width == ELEM_I32) {
+    return operand->ref[idx];
+  } else if (operand->width == ELEM_I16) {
+    return operand->ref16[idx];
+  }
+  return operand->ref8[idx];
+}
+
+static inline int int_term_val(Interpreter *interpreter, OperandTerm *op_term) {
+  return *op_term->operand.ref;
 }
 
 int eval_expr(Interpreter *interpreter, Expr *expr) {
 #ifndef NO_DEBUG
   interpreter->stats.expression_eval++;
+  if (expr->shape != EXPR_GENERAL) { // Counted by operand_read() otherwise
+    interpreter->stats.operand_read += expr->op_terms.item_cnts;
+  }
 #endif
   DynArr *op_terms = &expr->op_terms;
   int res = expr->constant;
   OperandTerm *op_term = op_terms->items;
+  // Plain branches predict better here than one shared jump table
+  if (expr->shape == EXPR_CONST) {
+    return res;
+  }
+  if (expr->shape == EXPR_INT_OFFSET || expr->shape == EXPR_INT) {
+    return int_term_val(interpreter, op_term) + res;
+  }
+  if (expr->shape == EXPR_INT2) {
+    return int_term_val(interpreter, &op_term[0]) * op_term[0].coefficient +
+           int_term_val(interpreter, &op_term[1]) * op_term[1].coefficient +
+           res;
+  }
+  if (expr->shape == EXPR_LINEAR) {
+    if (expr->soa) {
+      return res + linear_sum(expr->soa->coefs, expr->soa->refs,
+                              expr->soa->cnts);
+    }
+    for (int i = 0; i < op_terms->item_cnts; ++i, ++op_term) {
+      res += int_term_val(interpreter, op_term) * op_term->coefficient;
+    }
+    return res;
+  }
   for (int i = 0; i < op_terms->item_cnts; ++i, ++op_term) {
     int val = operand_read(interpreter, &op_term->operand);
     res += val * op_term->coefficient;
@@ -116,8 +175,6 @@ int eval_expr(Interpreter *interpreter, Expr *expr) {
   return res;
 }
 
-void execute_stmts(Interpreter *interpreter, DynArr *stmts);
-
 char do_cmp(cmp_type cond_typ, int left, int right) {
   // Assume it always within range ...
   // if (cond_typ < 0 || cond_typ >= 6)
@@ -149,7 +206,7 @@ typedef void (*StmtHandler)(Interpreter *interpreter, Stmt *stmt);
 static void execute_yosoro(Interpreter *interpreter, Stmt *stmt) {
   YosoroStmt *yosoro = &stmt->inner.yosoro;
   int res = eval_expr(interpreter, &yosoro->expr);
-  printf("%d ", res);
+  print_num(res);
 }
 
 static void execute_set(Interpreter *interpreter, Stmt *stmt) {
@@ -158,55 +215,295 @@ static void execute_set(Interpreter *interpreter, Stmt *stmt) {
   operand_write(interpreter, &set->operand, res);
 }
 
-static void execute_ihu(Interpreter *interpreter, Stmt *stmt) {
-  IhuStmt *ihu = &stmt->inner.ihu;
-  Cond *cond = &ihu->cond;
-  DynArr *stmts = &ihu->stmts;
-  if (!execute_cond(interpreter, cond))
-    return;
-  execute_stmts(interpreter, stmts);
+// First of the `cnts` elements a bulk kernel touches
+static int *bulk_elem_ref(Interpreter *interpreter, unsigned short decl_idx,
+                          int idx, usize cnts) {
+  VarDecl *decl = interpreter_decl(interpreter, decl_idx);
+#ifdef CHECKED
+  bounds_check_range(decl, idx, cnts);
+#endif
+  return &decl->data.a.arr[idx - decl->start];
 }
 
-static void execute_while(Interpreter *interpreter, Stmt *stmt) {
-  WhileStmt *while_stmt = &stmt->inner.while_stmt;
-  Cond *cond = &while_stmt->cond;
-  DynArr *stmts = &while_stmt->stmts;
-  while (execute_cond(interpreter, cond)) {
-    execute_stmts(interpreter, stmts);
+static int reduce_bulk_srcs(Interpreter *interpreter, BulkStmt *bulk,
+                            int start, usize cnts) {
+  unsigned sum = 0;
+  BulkSrc *src = bulk->srcs.items;
+  for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+    int offset = eval_expr(interpreter, &src->offset);
+    int *elems =
+        bulk_elem_ref(interpreter, src->decl_idx, start + offset, cnts);
+    sum += (unsigned)src->coefficient * bulk_sum(elems, cnts);
   }
+  return sum;
 }
 
-static void execute_hor(Interpreter *interpreter, Stmt *stmt) {
-  HorStmt *hor = &stmt->inner.hor;
-  int start = eval_expr(interpreter, &hor->start);
-  int end = eval_expr(interpreter, &hor->end);
-  Operand *var = &hor->var;
-  DynArr *stmts = &hor->stmts;
-  for (int i = start; i <= end; i++) {
-    operand_write(interpreter, var, i);
-    execute_stmts(interpreter, stmts);
+static void execute_bulk(Interpreter *interpreter, Stmt *stmt) {
+  BulkStmt *bulk = &stmt->inner.bulk;
+  int start = eval_expr(interpreter, &bulk->start);
+  int end = eval_expr(interpreter, &bulk->end);
+  if (start > end) {
+    return;
+  }
+  usize cnts = (unsigned)end - (unsigned)start + 1;
+  int val = eval_expr(interpreter, &bulk->val);
+  if (bulk->kind == BULK_REDUCE) {
+    VarDecl *acc = interpreter_decl(interpreter, bulk->dst_idx);
+    unsigned sum = reduce_bulk_srcs(interpreter, bulk, start, cnts);
+    sum += bulk_series_sum(start, cnts, bulk->stride, val);
+    acc->data.i.val += sum;
+    operand_write(interpreter, &bulk->var, end);
+    return;
+  }
+  int dst_offset = eval_expr(interpreter, &bulk->dst_offset);
+  int *dst =
+      bulk_elem_ref(interpreter, bulk->dst_idx, start + dst_offset, cnts);
+  switch (bulk->kind) {
+  case BULK_FILL:
+    bulk_fill(dst, cnts, val);
+    break;
+  case BULK_IOTA:
+    bulk_iota(dst, cnts, (unsigned)bulk->stride * start + val, bulk->stride);
+    break;
+  case BULK_COPY: {
+    BulkSrc *src = bulk->srcs.items;
+    int src_offset = eval_expr(interpreter, &src->offset);
+    int *elems =
+        bulk_elem_ref(interpreter, src->decl_idx, start + src_offset, cnts);
+    bulk_copy(dst, elems, cnts, val);
+  } break;
+  case BULK_REDUCE:
+    break;
   }
+  operand_write(interpreter, &bulk->var, end);
 }
 
+// Leaf statements only, compound ones are run from the flat stream
 void execute_stmt(Interpreter *interpreter, Stmt *stmt) {
   static StmtHandler handlers[] = {
-      execute_ihu, execute_while, execute_hor, execute_yosoro, execute_set,
+      [STMT_YOSORO_CMD] = execute_yosoro,
+      [STMT_SET_CMD] = execute_set,
+      [STMT_BULK_LOOP] = execute_bulk,
   };
   StmtHandler handler = handlers[stmt->typ];
   handler(interpreter, stmt);
 }
 
-inline void execute_stmts(Interpreter *interpreter, DynArr *stmts) {
+/* Flat statement stream */
+
+static enum FlatTyp hor_flat_typ(HorStmt *hor) {
+  Operand *var = &hor->var;
+  if (var->typ != OPERAND_INT_VAR) {
+    return FLAT_HOR;
+  }
+  return stmts_refs_decl(&hor->stmts, var->decl_idx) ? FLAT_HOR_INT
+                                                      : FLAT_HOR_REG;
+}
+
+// Pre-order, returns the deepest `hor` nesting
+static usize flatten_stmts(Interpreter *interpreter, DynArr *stmts) {
+  DynArr *flats = &interpreter->flats;
+  usize max_depth = 0;
   Stmt *stmt = stmts->items;
   for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
-    execute_stmt(interpreter, stmt);
+    usize header = flats->item_cnts;
+    FlatStmt *flat = da_try_push_back(flats);
+    flat->stmt = stmt;
+    flat->jmp = 0;
+    DynArr *body = NULL;
+    enum FlatTyp end_typ = FLAT_IHU; // `ihu` has no end entry
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      flat->typ = FLAT_IHU;
+      body = &stmt->inner.ihu.stmts;
+      break;
+    case STMT_WHILE_BLK:
+      flat->typ = FLAT_WHILE;
+      body = &stmt->inner.while_stmt.stmts;
+      end_typ = FLAT_WHILE_END;
+      break;
+    case STMT_HOR_BLK:
+      flat->typ = hor_flat_typ(&stmt->inner.hor);
+      body = &stmt->inner.hor.stmts;
+      end_typ = flat->typ + 1; // The matching `*_NEXT`
+      break;
+    case STMT_YOSORO_CMD:
+      flat->typ = FLAT_YOSORO;
+      break;
+    case STMT_SET_CMD:
+      flat->typ = FLAT_SET;
+      break;
+    case STMT_BULK_LOOP:
+      flat->typ = FLAT_BULK;
+      break;
+    }
+    if (!body) {
+      continue;
+    }
+    usize depth = flatten_stmts(interpreter, body);
+    if (end_typ != FLAT_IHU) {
+      // Back-edge to the header
+      FlatStmt *end = da_try_push_back(flats);
+      end->typ = end_typ;
+      end->stmt = stmt;
+      end->jmp = header;
+    }
+    if (stmt->typ == STMT_HOR_BLK) {
+      depth++;
+    }
+    // Skip past the block
+    ((FlatStmt *)da_get(flats, header))->jmp = flats->item_cnts;
+    if (depth > max_depth) {
+      max_depth = depth;
+    }
   }
+  return max_depth;
+}
+
+static void interpreter_flatten(Interpreter *interpreter) {
+  da_init(&interpreter->flats, sizeof(FlatStmt), 64);
+  usize max_depth = flatten_stmts(interpreter, interpreter->stmts);
+  da_init(&interpreter->frames, sizeof(HorFrame), max_depth ? max_depth : 1);
+#ifdef PROFILE
+  profiler_init(&interpreter->profiler, &interpreter->flats);
+#endif
+}
+
+static inline usize execute_ihu(Interpreter *interpreter, FlatStmt *flat,
+                                usize pc) {
+  Cond *cond = &flat->stmt->inner.ihu.cond;
+  return execute_cond(interpreter, cond) ? pc + 1 : flat->jmp;
+}
+
+static inline usize execute_while(Interpreter *interpreter, FlatStmt *flat,
+                                  usize pc) {
+  Cond *cond = &flat->stmt->inner.while_stmt.cond;
+  return execute_cond(interpreter, cond) ? pc + 1 : flat->jmp;
+}
+
+#ifdef CHECKED
+static void check_bounds_hoists(Interpreter *interpreter, HorStmt *hor,
+                                int start, int end) {
+  if (!hor->hoists) {
+    return;
+  }
+  BoundsHoist *hoist = hor->hoists->items;
+  for (int i = 0; i < hor->hoists->item_cnts; i++, hoist++) {
+    int rest = eval_expr(interpreter, &hoist->rest);
+    bounds_check_hoist(interpreter_decl(interpreter, hoist->decl_idx),
+                       hoist->coefficient, start, end, rest);
+  }
+}
+#endif
+
+// `top` caches the innermost frame, the enclosing ones are spilled
+static inline usize execute_hor(Interpreter *interpreter, FlatStmt *flat,
+                                usize pc, HorFrame *top) {
+  HorStmt *hor = &flat->stmt->inner.hor;
+  int start = eval_expr(interpreter, &hor->start);
+  int end = eval_expr(interpreter, &hor->end);
+  if (start > end) {
+    return flat->jmp;
+  }
+#ifdef CHECKED
+  check_bounds_hoists(interpreter, hor, start, end);
+#endif
+  *(HorFrame *)da_try_push_back(&interpreter->frames) = *top;
+  top->i = start;
+  top->left = (unsigned)end - (unsigned)start;
+  top->ref = hor->var.ref;
+  if (flat->typ == FLAT_HOR_INT) {
+    *top->ref = start;
+  } else if (flat->typ == FLAT_HOR) {
+    operand_write(interpreter, &hor->var, start);
+  }
+  return pc + 1;
+}
+
+static inline usize execute_hor_next(Interpreter *interpreter, FlatStmt *flat,
+                                     usize pc, HorFrame *top) {
+  if (!top->left) {
+    if (flat->typ == FLAT_HOR_REG_NEXT) {
+      *top->ref = top->i;
+    }
+    DynArr *frames = &interpreter->frames;
+    *top = *(HorFrame *)da_get(frames, --frames->item_cnts);
+    return pc + 1;
+  }
+  top->left--;
+  top->i++;
+  if (flat->typ == FLAT_HOR_INT_NEXT) {
+    *top->ref = top->i;
+  } else if (flat->typ == FLAT_HOR_NEXT) {
+    operand_write(interpreter, &flat->stmt->inner.hor.var, top->i);
+  }
+  return flat->jmp + 1;
 }
 
 void interpreter_execute(Interpreter *interpreter) {
-  DynArr *stmts = interpreter->stmts;
-  execute_stmts(interpreter, stmts);
+  interpreter_flatten(interpreter);
+  FlatStmt *flats = interpreter->flats.items;
+  usize cnts = interpreter->flats.item_cnts;
+  usize pc = 0;
+  HorFrame top = {0};
+#define EXEC(x) x(interpreter, flat, pc)
+#define EXEC_HOR(x) x(interpreter, flat, pc, &top)
+  while (pc < cnts) {
+    FlatStmt *flat = &flats[pc];
+#ifdef PROFILE
+    // Loop ends are charged to their header
+    if (flat_is_loop_end(flat->typ)) {
+      profiler_enter(&interpreter->profiler, flat->jmp, 1);
+    } else {
+      profiler_enter(&interpreter->profiler, pc, 0);
+    }
+#endif
+    switch (flat->typ) {
+    case FLAT_IHU:
+      pc = EXEC(execute_ihu);
+      break;
+    case FLAT_WHILE:
+      pc = EXEC(execute_while);
+      break;
+    case FLAT_WHILE_END:
+      pc = flat->jmp;
+      break;
+    case FLAT_HOR:
+    case FLAT_HOR_INT:
+    case FLAT_HOR_REG:
+      pc = EXEC_HOR(execute_hor);
+      break;
+    case FLAT_HOR_NEXT:
+    case FLAT_HOR_INT_NEXT:
+    case FLAT_HOR_REG_NEXT:
+      pc = EXEC_HOR(execute_hor_next);
+      break;
+    case FLAT_YOSORO:
+      execute_yosoro(interpreter, flat->stmt);
+      pc++;
+      break;
+    case FLAT_SET:
+      execute_set(interpreter, flat->stmt);
+      pc++;
+      break;
+    case FLAT_BULK:
+      execute_bulk(interpreter, flat->stmt);
+      pc++;
+      break;
+    }
+  }
+#ifdef PROFILE
+  profiler_stop(&interpreter->profiler);
+#endif
+#undef EXEC_HOR
+#undef EXEC
+}
+
+#ifdef PROFILE
+void interpreter_profile(Interpreter *interpreter, const char *src) {
+  profiler_report(&interpreter->profiler, src);
 }
+#endif
 
 #ifndef NO_DEBUG
 void interpreter_stats(Interpreter *interpreter) {
@@ -0,0 +1,162 @@
+#ifndef NO_CUSTOM_INC
+#include "kernels.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#if defined(__x86_64__)
+#ifndef NO_STD_INC
+#include <immintrin.h>
+#endif
+#endif
+
+// Arithmetic is done on `unsigned` to wrap like the engines do.
+
+void bulk_fill(int *dst, usize cnts, int val) {
+  if (val == 0 || val == -1) { // Uniform byte pattern
+    memset(dst, val, cnts * sizeof(int));
+    return;
+  }
+  for (usize i = 0; i < cnts; i++) {
+    dst[i] = val;
+  }
+}
+
+void bulk_iota(int *dst, usize cnts, int first, int stride) {
+  for (usize i = 0; i < cnts; i++) {
+    dst[i] = (unsigned)first + (unsigned)stride * i;
+  }
+}
+
+void bulk_copy(int *dst, const int *src, usize cnts, int addend) {
+  // When `dst` runs ahead of an overlapping `src`, later elements read
+  // values written by earlier ones, so only the element-wise loop keeps
+  // the meaning of the original `hor`.
+  int forward_safe = dst <= src || dst >= src + cnts;
+  if (!addend && forward_safe) {
+    memmove(dst, src, cnts * sizeof(int));
+    return;
+  }
+  for (usize i = 0; i < cnts; i++) {
+    dst[i] = (unsigned)src[i] + (unsigned)addend;
+  }
+}
+
+static int sum_scalar(const int *src, usize cnts) {
+  unsigned sum = 0;
+  for (usize i = 0; i < cnts; i++) {
+    sum += src[i];
+  }
+  return sum;
+}
+
+#if defined(__x86_64__)
+// Lane-wise `paddd` wraps exactly like the scalar loop.
+
+static int sum_sse2(const int *src, usize cnts) {
+  __m128i acc0 = _mm_setzero_si128();
+  __m128i acc1 = _mm_setzero_si128();
+  usize i = 0;
+  for (; i + 8 <= cnts; i += 8) {
+    acc0 = _mm_add_epi32(acc0, _mm_loadu_si128((const __m128i *)(src + i)));
+    acc1 =
+        _mm_add_epi32(acc1, _mm_loadu_si128((const __m128i *)(src + i + 4)));
+  }
+  __m128i acc = _mm_add_epi32(acc0, acc1);
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (unsigned)_mm_cvtsi128_si32(acc) + sum_scalar(src + i, cnts - i);
+}
+
+__attribute__((target("avx2"))) static int sum_avx2(const int *src,
+                                                    usize cnts) {
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  usize i = 0;
+  for (; i + 16 <= cnts; i += 16) {
+    acc0 = _mm256_add_epi32(
+        acc0, _mm256_loadu_si256((const __m256i *)(src + i)));
+    acc1 = _mm256_add_epi32(
+        acc1, _mm256_loadu_si256((const __m256i *)(src + i + 8)));
+  }
+  __m256i acc256 = _mm256_add_epi32(acc0, acc1);
+  __m128i acc = _mm_add_epi32(_mm256_castsi256_si128(acc256),
+                              _mm256_extracti128_si256(acc256, 1));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (unsigned)_mm_cvtsi128_si32(acc) + sum_sse2(src + i, cnts - i);
+}
+#endif
+
+#if defined(__x86_64__)
+static int has_avx2(void) {
+  static int supported = -1;
+  if (supported < 0) {
+    supported = __builtin_cpu_supports("avx2");
+  }
+  return supported;
+}
+#endif
+
+int bulk_sum(const int *src, usize cnts) {
+#if defined(__x86_64__)
+  return has_avx2() ? sum_avx2(src, cnts) : sum_sse2(src, cnts);
+#else
+  return sum_scalar(src, cnts);
+#endif
+}
+
+static int linear_sum_scalar(const int *coefs, const int *const *refs,
+                             usize cnts) {
+  unsigned sum = 0;
+  for (usize i = 0; i < cnts; i++) {
+    sum += (unsigned)coefs[i] * *refs[i];
+  }
+  return sum;
+}
+
+#if defined(__x86_64__)
+// The 8 lanes are filled with scalar loads rather than `vpgatherqd`, which
+// is slower than that on cores with the gather data sampling mitigation.
+// `vpmulld` keeps the low 32 bits like the scalar product.
+__attribute__((target("avx2"))) static int
+linear_sum_avx2(const int *coefs, const int *const *refs, usize cnts) {
+  __m256i acc = _mm256_setzero_si256();
+  usize i = 0;
+  for (; i + 8 <= cnts; i += 8) {
+    __m256i vals = _mm256_setr_epi32(*refs[i], *refs[i + 1], *refs[i + 2],
+                                     *refs[i + 3], *refs[i + 4], *refs[i + 5],
+                                     *refs[i + 6], *refs[i + 7]);
+    __m256i coef = _mm256_load_si256((const __m256i *)(coefs + i));
+    acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(vals, coef));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                              _mm256_extracti128_si256(acc, 1));
+  sum = _mm_hadd_epi32(sum, sum);
+  sum = _mm_hadd_epi32(sum, sum);
+  return (unsigned)_mm_cvtsi128_si32(sum) +
+         linear_sum_scalar(coefs + i, refs + i, cnts - i);
+}
+#endif
+
+int linear_sum(const int *coefs, const int *const *refs, usize cnts) {
+#if defined(__x86_64__)
+  if (has_avx2()) {
+    return linear_sum_avx2(coefs, refs, cnts);
+  }
+#endif
+  return linear_sum_scalar(coefs, refs, cnts);
+}
+
+int bulk_series_sum(int first, usize cnts, int stride, int val) {
+  // `cnts*(cnts-1)` fits in 64 bits, so the halving is exact
+  uint64_t n = cnts;
+  uint32_t vars = (uint32_t)(n * (uint32_t)first) +
+                  (uint32_t)(n * (n - 1) / 2);
+  return (unsigned)stride * vars + (unsigned)val * (uint32_t)n;
+}
@@ -30,6 +30,7 @@ void lexer_init(Lexer *lexer, char *src) {
   str_pool_init(&lexer->tok_val_pool, 256, 20);
   lexer->src_len = strlen(src);
   lexer->src = src;
+  lexer->line = 1;
   // lexer->src = malloc(lexer->src_len);
   // memcpy(lexer->src, src, lexer->src_len); // That's a copy!! :)
   da_init(&lexer->toks, sizeof(Token), 128);
@@ -69,6 +70,7 @@ inline static void add_token(Lexer *lexer, enum TokType tok_type,
                              const char *val) {
   Token *tok = da_try_push_back(&lexer->toks);
   token_init(tok, tok_type, val);
+  tok->line = lexer->line;
   return;
 }
 
@@ -115,6 +117,7 @@ void lexer_tokenize(Lexer *lexer) {
     char ch = lexer->src[lexer->ch_pos];
     // Ignore blank token
     if (isspace(ch)) {
+      lexer->line += ch == '\n';
       lexer->ch_pos++;
       continue;
     }
@@ -172,11 +175,12 @@ void lexer_tokenize(Lexer *lexer) {
       SCH_TOK(TOK_LBRACKET, '[')
       SCH_TOK(TOK_RBRACKET, ']')
     case '#':
-      // Skip until `\n`
-      while (lexer->src[lexer->ch_pos] != '\n') {
+      // Skip until `\n`, which is left to count the line
+      while (lexer->ch_pos < lexer->src_len &&
+             lexer->src[lexer->ch_pos] != '\n') {
         lexer->ch_pos++;
       }
-      break;
+      continue;
     default:
       // Double dot(..)
       if (ch == '.' && lexer->ch_pos + 1 < lexer->src_len &&
@@ -1,5 +1,7 @@
 #ifndef NO_CUSTOM_INC
 #include "lexer.h"
+#include "narrow.h"
+#include "optimizer.h"
 #include "parser.h"
 #include "utils.h"
 #endif
@@ -7,14 +9,42 @@
 #ifdef CODEGEN
 #ifndef NO_CUSTOM_INC
 #include "codegen.h"
+#include "reggen.h"
+#include "regvm.h"
 #include "vm.h"
 #endif
 #else
 #ifndef NO_CUSTOM_INC
+#include "closure.h"
+#endif
+#endif
+
+#if !defined(CODEGEN) || defined(PROFILE)
+#ifndef NO_CUSTOM_INC
 #include "interpreter.h"
 #endif
 #endif
 
+#ifdef RESULT_CACHE
+#ifndef NO_CUSTOM_INC
+#include "cache.h"
+#endif
+#endif
+
+#ifdef CHECKED
+#ifndef NO_CUSTOM_INC
+#include "bounds.h"
+#endif
+#endif
+
+#ifdef PARALLEL
+#ifndef CODEGEN
+#ifndef NO_CUSTOM_INC
+#include "parallel.h"
+#endif
+#endif
+#endif
+
 #ifndef NO_STD_INC
 #include <stddef.h>
 #include <stdio.h>
@@ -97,7 +127,64 @@ void test() {
   debug_parser(&parser);
 #endif
 
-#ifdef CODEGEN
+#ifdef RESULT_CACHE
+  ResultCache cache;
+  cache_init(&cache, cache_hash_program(&parser.stmts, &parser.var_decls));
+  int status = 0;
+  if (cache_replay(&cache, &status)) {
+    cache_free(&cache);
+    parser_free(&parser);
+    lexer_free(&lexer);
+    free(src);
+    if (status) {
+      exit(status);
+    }
+    return;
+  }
+  cache_begin(&cache);
+#endif
+
+#ifndef NO_OPTIMIZE
+  Optimizer opt;
+  optimizer_init(&opt, &parser.stmts, &parser.var_decls);
+  CLOCK_FUNC(start_time, end_time, time_spent, optimizer_run, &opt);
+#ifndef NO_DEBUG
+  optimizer_stats(&opt);
+#endif
+  Narrow narrow;
+  narrow_init(&narrow, &parser.stmts, &parser.var_decls);
+  CLOCK_FUNC(start_time, end_time, time_spent, narrow_run, &narrow);
+#ifndef NO_DEBUG
+  narrow_stats(&narrow);
+#endif
+  narrow_free(&narrow);
+#endif
+
+#ifdef CHECKED
+  Bounds bounds;
+  bounds_init(&bounds, &parser.stmts, &parser.var_decls);
+  CLOCK_FUNC(start_time, end_time, time_spent, bounds_run, &bounds);
+  bounds_stats(&bounds);
+  bounds_free(&bounds);
+#endif
+
+// Profiled runs stay on the flat interpreter, whatever the engine
+#if defined(CODEGEN) && defined(REGVM) && !defined(PROFILE)
+
+  RegGen rg;
+  rg_init(&rg, &parser.stmts, &parser.var_decls);
+  CLOCK_FUNC(start_time, end_time, time_spent, rg_gen, &rg);
+#ifndef NO_DEBUG
+  rg_debug(&rg);
+#endif
+  parser_free_stmts(&parser);
+  RegVM reg_vm;
+  reg_vm_init(&reg_vm, &parser.var_decls, &rg);
+  CLOCK_FUNC(start_time, end_time, time_spent, reg_vm_execute, &reg_vm);
+  rg_free(&rg);
+  parser_free_vars(&parser);
+
+#elif defined(CODEGEN) && !defined(PROFILE)
 
   CodeGen cg;
   cg_init(&cg, &parser.stmts, &parser.var_decls);
@@ -107,11 +194,34 @@ void test() {
 #endif
   parser_free_stmts(&parser);
   CyrVM cyr_vm;
-  cyr_vm_init(&cyr_vm, &parser.var_decls, &cg.codes);
+  cyr_vm_init(&cyr_vm, &parser.var_decls, &cg.codes, &cg.lin_terms,
+              cg.max_depth);
   CLOCK_FUNC(start_time, end_time, time_spent, cyr_vm_execute, &cyr_vm);
   cg_free(&cg);
   parser_free_vars(&parser);
 
+#elif defined(CLOSURE) && !defined(CHECKED) && !defined(PROFILE)
+  // Checked and profiled runs stay on the flat interpreter
+
+  Closure closure;
+  closure_init(&closure, &parser.stmts, &parser.var_decls);
+  CLOCK_FUNC(start_time, end_time, time_spent, closure_compile, &closure);
+  CLOCK_FUNC(start_time, end_time, time_spent, closure_execute, &closure);
+#ifndef NO_DEBUG
+  closure_stats(&closure);
+#endif
+  closure_free(&closure);
+
+#elif defined(PARALLEL) && !defined(CHECKED) && !defined(PROFILE)
+
+  Parallel par;
+  parallel_init(&par, &parser.stmts, &parser.var_decls);
+  CLOCK_FUNC(start_time, end_time, time_spent, parallel_execute, &par);
+#ifndef NO_DEBUG
+  parallel_stats(&par);
+#endif
+  parallel_free(&par);
+
 #else
 
   Interpreter interpreter;
@@ -121,12 +231,20 @@ void test() {
              &interpreter);
 #ifndef NO_DEBUG
   interpreter_stats(&interpreter);
+#endif
+#ifdef PROFILE
+  interpreter_profile(&interpreter, src);
 #endif
   interpreter_free(&interpreter);
 
 #endif
 
-#ifndef CODEGEN
+#ifdef RESULT_CACHE
+  cache_store(&cache, 0);
+  cache_free(&cache);
+#endif
+
+#if !defined(CODEGEN) || defined(PROFILE)
   parser_free(&parser);
 #endif
   lexer_free(&lexer);
@@ -0,0 +1,223 @@
+#ifndef NO_CUSTOM_INC
+#include "narrow.h"
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+void narrow_init(Narrow *narrow, DynArr *stmts, DynArr *var_decls) {
+  memset(narrow, 0, sizeof(Narrow));
+  narrow->stmts = stmts;
+  narrow->var_decls = var_decls;
+  usize cnts = var_decls->item_cnts;
+  // Everything starts at 0
+  da_init(&narrow->ranges, sizeof(ValRange), cnts ? cnts : 1);
+  memset(da_pushs_back(&narrow->ranges, cnts), 0, cnts * sizeof(ValRange));
+  da_init(&narrow->pinned, sizeof(char), cnts ? cnts : 1);
+  memset(da_pushs_back(&narrow->pinned, cnts), 0, cnts);
+}
+
+Narrow *narrow_create(DynArr *stmts, DynArr *var_decls) {
+  Narrow *narrow = malloc(sizeof(Narrow));
+  narrow_init(narrow, stmts, var_decls);
+  return narrow;
+}
+
+void narrow_free(Narrow *narrow) {
+  da_free(&narrow->ranges);
+  da_free(&narrow->pinned);
+}
+
+// NULL for undeclared names
+static ValRange *decl_range(Narrow *narrow, unsigned short decl_idx) {
+  if (decl_idx >= narrow->ranges.item_cnts) {
+    return NULL;
+  }
+  return (ValRange *)(narrow->ranges.items) + decl_idx;
+}
+
+static const ValRange full_range = {INT_MIN, INT_MAX};
+
+static void join_range(Narrow *narrow, unsigned short decl_idx,
+                       ValRange val) {
+  ValRange *range = decl_range(narrow, decl_idx);
+  if (!range) {
+    return;
+  }
+  int widen = narrow->rounds >= NARROW_WIDEN_ROUNDS;
+  if (val.lo < range->lo) {
+    range->lo = widen ? INT_MIN : val.lo;
+    narrow->changed = 1;
+  }
+  if (val.hi > range->hi) {
+    range->hi = widen ? INT_MAX : val.hi;
+    narrow->changed = 1;
+  }
+}
+
+// A result that leaves `int` may have wrapped to anything
+static ValRange expr_range(Narrow *narrow, Expr *expr) {
+  long long lo = expr->constant;
+  long long hi = expr->constant;
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    // Every element of an array shares its range
+    ValRange *range = decl_range(narrow, op_term->operand.decl_idx);
+    if (!range) {
+      return full_range;
+    }
+    long long coef = op_term->coefficient;
+    long long a = range->lo * coef; // Both fit in 32 bits
+    long long b = range->hi * coef;
+    if (coef < 0) {
+      long long t = a;
+      a = b;
+      b = t;
+    }
+    if (__builtin_add_overflow(lo, a, &lo) ||
+        __builtin_add_overflow(hi, b, &hi)) {
+      return full_range;
+    }
+  }
+  if (lo < INT_MIN || hi > INT_MAX) {
+    return full_range;
+  }
+  return (ValRange){lo, hi};
+}
+
+// The loop variable walks `[start, end]`, and the VM leaves `end` in it
+static ValRange loop_range(Narrow *narrow, Expr *start, Expr *end) {
+  ValRange start_range = expr_range(narrow, start);
+  ValRange end_range = expr_range(narrow, end);
+  return (ValRange){
+      start_range.lo < end_range.lo ? start_range.lo : end_range.lo,
+      start_range.hi > end_range.hi ? start_range.hi : end_range.hi,
+  };
+}
+
+static void pin_decl(Narrow *narrow, unsigned short decl_idx) {
+  if (decl_idx < narrow->pinned.item_cnts) {
+    ((char *)narrow->pinned.items)[decl_idx] = 1;
+  }
+}
+
+static void visit_bulk(Narrow *narrow, BulkStmt *bulk) {
+  join_range(narrow, bulk->var.decl_idx,
+             loop_range(narrow, &bulk->start, &bulk->end));
+  join_range(narrow, bulk->dst_idx, full_range);
+  pin_decl(narrow, bulk->dst_idx);
+  BulkSrc *src = bulk->srcs.items;
+  for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+    pin_decl(narrow, src->decl_idx);
+  }
+}
+
+static void visit_stmts(Narrow *narrow, DynArr *stmts) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      visit_stmts(narrow, &stmt->inner.ihu.stmts);
+      break;
+    case STMT_WHILE_BLK:
+      visit_stmts(narrow, &stmt->inner.while_stmt.stmts);
+      break;
+    case STMT_HOR_BLK: {
+      HorStmt *hor = &stmt->inner.hor;
+      join_range(narrow, hor->var.decl_idx,
+                 loop_range(narrow, &hor->start, &hor->end));
+      visit_stmts(narrow, &hor->stmts);
+    } break;
+    case STMT_SET_CMD: {
+      SetStmt *set = &stmt->inner.set;
+      join_range(narrow, set->operand.decl_idx,
+                 expr_range(narrow, &set->expr));
+    } break;
+    case STMT_BULK_LOOP:
+      visit_bulk(narrow, &stmt->inner.bulk);
+      break;
+    case STMT_YOSORO_CMD:
+      break;
+    }
+  }
+}
+
+// Nothing has run yet, so the storage is still all zeros
+static void narrow_arr(Narrow *narrow, VarDecl *decl, ValRange *range) {
+  usize cnts = decl->end - decl->start + 1;
+  VarArrData *arr_data = &decl->data.a;
+  usize size;
+  if (range->lo >= SCHAR_MIN && range->hi <= SCHAR_MAX) {
+    arr_data->width = ELEM_I8;
+    size = sizeof(signed char);
+#ifndef NO_DEBUG
+    narrow->stats.narrowed8++;
+#endif
+  } else if (range->lo >= SHRT_MIN && range->hi <= SHRT_MAX) {
+    arr_data->width = ELEM_I16;
+    size = sizeof(short);
+#ifndef NO_DEBUG
+    narrow->stats.narrowed16++;
+#endif
+  } else {
+    return;
+  }
+  free(arr_data->arr);
+  arr_data->arr = calloc(cnts, size);
+#ifndef NO_DEBUG
+  narrow->stats.saved_bytes += cnts * (sizeof(int) - size);
+#endif
+}
+
+void narrow_analyze(Narrow *narrow) {
+  do {
+    narrow->changed = 0;
+    visit_stmts(narrow, narrow->stmts);
+    narrow->rounds++;
+  } while (narrow->changed);
+}
+
+// Holds at any point of the run
+ValRange narrow_range(Narrow *narrow, unsigned short decl_idx) {
+  ValRange *range = decl_range(narrow, decl_idx);
+  return range ? *range : full_range;
+}
+
+void narrow_run(Narrow *narrow) {
+  narrow_analyze(narrow);
+
+  VarDecl *decl = narrow->var_decls->items;
+  char *pinned = narrow->pinned.items;
+  for (int i = 0; i < narrow->var_decls->item_cnts; i++, decl++) {
+    if (decl->typ != VAR_ARR) {
+      continue;
+    }
+#ifndef NO_DEBUG
+    narrow->stats.arrs++;
+#endif
+    if (!pinned[i]) {
+      narrow_arr(narrow, decl, decl_range(narrow, i));
+    }
+  }
+}
+
+#ifndef NO_DEBUG
+void narrow_stats(Narrow *narrow) {
+  struct NarrowStats stats = narrow->stats;
+  logger("Narrow Stats:\n"
+         "Arrays\n"
+         "  Total    : %zu\n"
+         "  8 bits   : %zu\n"
+         "  16 bits  : %zu\n"
+         "  Saved    : %zu bytes\n"
+         "Rounds     : %zu\n",
+         stats.arrs, stats.narrowed8, stats.narrowed16, stats.saved_bytes,
+         narrow->rounds);
+}
+#endif
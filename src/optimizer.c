@@ -0,0 +1,532 @@
+#ifndef NO_CUSTOM_INC
+#include "optimizer.h"
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+void optimizer_init(Optimizer *opt, DynArr *stmts, DynArr *var_decls) {
+  memset(opt, 0, sizeof(Optimizer));
+  opt->stmts = stmts;
+  opt->var_decls = var_decls;
+  opt->unroll_budget = UNROLL_BUDGET;
+}
+
+Optimizer *optimizer_create(DynArr *stmts, DynArr *var_decls) {
+  Optimizer *opt = malloc(sizeof(Optimizer));
+  optimizer_init(opt, stmts, var_decls);
+  return opt;
+}
+
+void fold_expr(Expr *expr) {
+  // Merge equal operands (index expressions may have become equal after
+  // substitution), then cut-off terms that coefficient=0
+  DynArr *op_terms = &expr->op_terms;
+  OperandTerm *terms = op_terms->items;
+  usize cnts = 0;
+  for (int i = 0; i < op_terms->item_cnts; i++) {
+    OperandTerm op_term = terms[i];
+    if (op_term.operand.typ == OPERAND_ARR_ELEM) {
+      fold_expr(&op_term.operand.idx_expr);
+    }
+    int merged = 0;
+    for (int j = 0; j < cnts; j++) {
+      if (is_operand_eq(&terms[j].operand, &op_term.operand)) {
+        terms[j].coefficient += op_term.coefficient;
+        free_operand(&op_term.operand);
+        merged = 1;
+        break;
+      }
+    }
+    if (!merged) {
+      terms[cnts++] = op_term;
+    }
+  }
+  usize kept = 0;
+  for (int i = 0; i < cnts; i++) {
+    if (terms[i].coefficient == 0) {
+      free_operand(&terms[i].operand);
+      continue;
+    }
+    terms[kept++] = terms[i];
+  }
+  op_terms->item_cnts = kept;
+  optimize_expr(NULL, expr);
+}
+
+static void fold_cond(Cond *cond) {
+  fold_expr(&cond->left);
+  fold_expr(&cond->right);
+}
+
+static void fold_operand(Operand *operand) {
+  if (operand->typ == OPERAND_ARR_ELEM) {
+    fold_expr(&operand->idx_expr);
+  }
+}
+
+static void fold_bulk(BulkStmt *bulk) {
+  fold_expr(&bulk->start);
+  fold_expr(&bulk->end);
+  fold_expr(&bulk->dst_offset);
+  BulkSrc *src = bulk->srcs.items;
+  for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+    fold_expr(&src->offset);
+  }
+  fold_expr(&bulk->val);
+}
+
+static int is_const_expr(Expr *expr) { return !expr->op_terms.item_cnts; }
+
+static void init_const_expr(Expr *expr, int constant) {
+  da_init(&expr->op_terms, sizeof(OperandTerm), 1);
+  expr->constant = constant;
+  expr->shape = EXPR_CONST;
+  expr->soa = NULL;
+}
+
+static void subst_expr(Expr *expr, unsigned short decl_idx, int val) {
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    Operand *operand = &op_term->operand;
+    if (operand->typ == OPERAND_INT_VAR && operand->decl_idx == decl_idx) {
+      // Wrap like the engines do
+      expr->constant += (unsigned)op_term->coefficient * (unsigned)val;
+      op_term->coefficient = 0; // Dropped by fold_expr()
+    } else if (operand->typ == OPERAND_ARR_ELEM) {
+      subst_expr(&operand->idx_expr, decl_idx, val);
+    }
+  }
+}
+
+static void subst_operand(Operand *operand, unsigned short decl_idx,
+                          int val) {
+  if (operand->typ == OPERAND_ARR_ELEM) {
+    subst_expr(&operand->idx_expr, decl_idx, val);
+  }
+}
+
+static void subst_cond(Cond *cond, unsigned short decl_idx, int val) {
+  subst_expr(&cond->left, decl_idx, val);
+  subst_expr(&cond->right, decl_idx, val);
+}
+
+static void subst_bulk(BulkStmt *bulk, unsigned short decl_idx, int val) {
+  subst_expr(&bulk->start, decl_idx, val);
+  subst_expr(&bulk->end, decl_idx, val);
+  subst_expr(&bulk->dst_offset, decl_idx, val);
+  BulkSrc *src = bulk->srcs.items;
+  for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+    subst_expr(&src->offset, decl_idx, val);
+  }
+  subst_expr(&bulk->val, decl_idx, val);
+}
+
+static void subst_stmts(DynArr *stmts, unsigned short decl_idx, int val) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      subst_cond(&stmt->inner.ihu.cond, decl_idx, val);
+      subst_stmts(&stmt->inner.ihu.stmts, decl_idx, val);
+      break;
+    case STMT_WHILE_BLK:
+      subst_cond(&stmt->inner.while_stmt.cond, decl_idx, val);
+      subst_stmts(&stmt->inner.while_stmt.stmts, decl_idx, val);
+      break;
+    case STMT_HOR_BLK:
+      subst_operand(&stmt->inner.hor.var, decl_idx, val);
+      subst_expr(&stmt->inner.hor.start, decl_idx, val);
+      subst_expr(&stmt->inner.hor.end, decl_idx, val);
+      subst_stmts(&stmt->inner.hor.stmts, decl_idx, val);
+      break;
+    case STMT_YOSORO_CMD:
+      subst_expr(&stmt->inner.yosoro.expr, decl_idx, val);
+      break;
+    case STMT_SET_CMD:
+      subst_operand(&stmt->inner.set.operand, decl_idx, val);
+      subst_expr(&stmt->inner.set.expr, decl_idx, val);
+      break;
+    case STMT_BULK_LOOP:
+      subst_bulk(&stmt->inner.bulk, decl_idx, val);
+      break;
+    }
+  }
+}
+
+static int writes_int_var(DynArr *stmts, unsigned short decl_idx) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    Operand *written = NULL;
+    DynArr *body = NULL;
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      body = &stmt->inner.ihu.stmts;
+      break;
+    case STMT_WHILE_BLK:
+      body = &stmt->inner.while_stmt.stmts;
+      break;
+    case STMT_HOR_BLK:
+      written = &stmt->inner.hor.var;
+      body = &stmt->inner.hor.stmts;
+      break;
+    case STMT_SET_CMD:
+      written = &stmt->inner.set.operand;
+      break;
+    case STMT_BULK_LOOP:
+      written = &stmt->inner.bulk.var;
+      if (stmt->inner.bulk.kind == BULK_REDUCE &&
+          stmt->inner.bulk.dst_idx == decl_idx) {
+        return 1;
+      }
+      break;
+    case STMT_YOSORO_CMD:
+      break;
+    }
+    if (written && written->typ == OPERAND_INT_VAR &&
+        written->decl_idx == decl_idx) {
+      return 1;
+    }
+    if (body && writes_int_var(body, decl_idx)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static usize count_stmts(DynArr *stmts) {
+  usize cnts = stmts->item_cnts;
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      cnts += count_stmts(&stmt->inner.ihu.stmts);
+      break;
+    case STMT_WHILE_BLK:
+      cnts += count_stmts(&stmt->inner.while_stmt.stmts);
+      break;
+    case STMT_HOR_BLK:
+      cnts += count_stmts(&stmt->inner.hor.stmts);
+      break;
+    default:
+      break;
+    }
+  }
+  return cnts;
+}
+
+static void move_stmts(DynArr *dest, DynArr *src) {
+  // Stmts own their members, so moving them is a plain copy
+  if (src->item_cnts) {
+    memcpy(da_pushs_back(dest, src->item_cnts), src->items,
+           src->item_cnts * sizeof(Stmt));
+  }
+  da_free(src);
+}
+
+static void opt_stmts(Optimizer *opt, DynArr *stmts);
+
+static int try_unroll_hor(Optimizer *opt, Stmt *stmt, DynArr *out) {
+  HorStmt *hor = &stmt->inner.hor;
+  Operand *var = &hor->var;
+  if (var->typ != OPERAND_INT_VAR ||
+      var->decl_idx >= opt->var_decls->item_cnts) {
+    return 0;
+  }
+  if (!is_const_expr(&hor->start) || !is_const_expr(&hor->end)) {
+    return 0;
+  }
+  int start = hor->start.constant;
+  int end = hor->end.constant;
+  long long trip_cnts = (long long)end - start + 1;
+  // Engines disagree on the loop variable after a zero-trip loop, keep it.
+  if (trip_cnts <= 0) {
+    return 0;
+  }
+  long long unrolled_size = trip_cnts * count_stmts(&hor->stmts);
+  if (unrolled_size > UNROLL_MAX_STMTS ||
+      unrolled_size > opt->unroll_budget) {
+    return 0;
+  }
+  // The loop variable must only be stepped by the loop itself
+  if (writes_int_var(&hor->stmts, var->decl_idx)) {
+    return 0;
+  }
+  opt->unroll_budget -= unrolled_size;
+
+  DynArr unrolled;
+  da_init(&unrolled, sizeof(Stmt), unrolled_size + 1);
+  for (int val = start;; val++) {
+    DynArr body;
+    clone_stmts(&body, &hor->stmts);
+    subst_stmts(&body, var->decl_idx, val);
+    move_stmts(&unrolled, &body);
+    if (val == end) {
+      break;
+    }
+  }
+  // Keep the final value of the loop variable
+  Stmt *final_set = da_try_push_back(&unrolled);
+  final_set->typ = STMT_SET_CMD;
+  final_set->line = stmt->line;
+  final_set->inner.set.operand = *var;
+  init_const_expr(&final_set->inner.set.expr, end);
+
+  // Folding may turn nested loops into constant ones
+  opt_stmts(opt, &unrolled);
+  move_stmts(out, &unrolled);
+  free_stmt(stmt);
+#ifndef NO_DEBUG
+  opt->stats.unrolled_hors++;
+#endif
+  return 1;
+}
+
+static int try_fold_ihu(Optimizer *opt, Stmt *stmt, DynArr *out) {
+  IhuStmt *ihu = &stmt->inner.ihu;
+  Cond *cond = &ihu->cond;
+  if (!is_const_expr(&cond->left) || !is_const_expr(&cond->right)) {
+    return 0;
+  }
+  if (do_cmp(cond->typ, cond->left.constant, cond->right.constant)) {
+    opt_stmts(opt, &ihu->stmts);
+    move_stmts(out, &ihu->stmts);
+    free_expr(&cond->left);
+    free_expr(&cond->right);
+  } else {
+    free_stmt(stmt);
+  }
+#ifndef NO_DEBUG
+  opt->stats.folded_ihus++;
+#endif
+  return 1;
+}
+
+// Split `expr` into `coefficient*var + rest`, returns the coefficient
+static int split_var_term(Expr *expr, unsigned short var_idx, Expr *rest) {
+  clone_expr(rest, expr);
+  OperandTerm *terms = rest->op_terms.items;
+  for (int i = 0; i < rest->op_terms.item_cnts; i++) {
+    if (terms[i].operand.typ == OPERAND_INT_VAR &&
+        terms[i].operand.decl_idx == var_idx) {
+      int coefficient = terms[i].coefficient;
+      memmove(&terms[i], &terms[i + 1],
+              (rest->op_terms.item_cnts - i - 1) * sizeof(OperandTerm));
+      rest->op_terms.item_cnts--;
+      return coefficient;
+    }
+  }
+  return 0;
+}
+
+// `rest` of `var+rest`, invariant while `var` and `dst` change.
+// `rest` is set even on failure.
+static int split_affine_idx(Expr *idx_expr, unsigned short var_idx,
+                            unsigned short dst_idx, Expr *rest) {
+  return split_var_term(idx_expr, var_idx, rest) == 1 &&
+         !expr_refs_decl(rest, var_idx) && !expr_refs_decl(rest, dst_idx);
+}
+
+static int is_arr_decl(Optimizer *opt, unsigned short decl_idx) {
+  if (decl_idx >= opt->var_decls->item_cnts) {
+    return 0;
+  }
+  VarDecl *decl = (VarDecl *)(opt->var_decls->items) + decl_idx;
+  return decl->typ == VAR_ARR;
+}
+
+// Move every `coefficient*src[var+offset]` term of `val` into `srcs`
+static int extract_bulk_srcs(Optimizer *opt, BulkStmt *bulk) {
+  unsigned short var_idx = bulk->var.decl_idx;
+  OperandTerm *terms = bulk->val.op_terms.items;
+  for (int i = 0; i < bulk->val.op_terms.item_cnts; i++) {
+    Operand *operand = &terms[i].operand;
+    if (operand->typ != OPERAND_ARR_ELEM ||
+        !expr_refs_decl(&operand->idx_expr, var_idx)) {
+      continue;
+    }
+    if (!is_arr_decl(opt, operand->decl_idx)) {
+      return 0;
+    }
+    BulkSrc *src = da_try_push_back(&bulk->srcs);
+    src->coefficient = terms[i].coefficient;
+    src->decl_idx = operand->decl_idx;
+    if (!split_affine_idx(&operand->idx_expr, var_idx, bulk->dst_idx,
+                          &src->offset)) {
+      return 0;
+    }
+    free_operand(operand);
+    memmove(&terms[i], &terms[i + 1],
+            (bulk->val.op_terms.item_cnts - i - 1) * sizeof(OperandTerm));
+    bulk->val.op_terms.item_cnts--;
+    i--;
+  }
+  return 1;
+}
+
+// `:set dst[var+dst_offset], ...`
+static int match_bulk_map(Optimizer *opt, BulkStmt *bulk, SetStmt *set) {
+  free_expr(&bulk->dst_offset);
+  if (!split_affine_idx(&set->operand.idx_expr, bulk->var.decl_idx,
+                        bulk->dst_idx, &bulk->dst_offset)) {
+    return 0;
+  }
+  free_expr(&bulk->val);
+  bulk->stride = split_var_term(&set->expr, bulk->var.decl_idx, &bulk->val);
+  if (!extract_bulk_srcs(opt, bulk)) {
+    return 0;
+  }
+  BulkSrc *src = bulk->srcs.items;
+  switch (bulk->srcs.item_cnts) {
+  case 0:
+    bulk->kind = bulk->stride ? BULK_IOTA : BULK_FILL;
+    return 1;
+  case 1:
+    bulk->kind = BULK_COPY;
+    return !bulk->stride && src->coefficient == 1;
+  default:
+    return 0;
+  }
+}
+
+// `:set dst, dst + ...`, the order of the additions does not matter
+// since they wrap
+static int match_bulk_reduce(Optimizer *opt, BulkStmt *bulk, SetStmt *set) {
+  Expr rest;
+  int self = split_var_term(&set->expr, bulk->dst_idx, &rest);
+  free_expr(&bulk->val);
+  bulk->stride = split_var_term(&rest, bulk->var.decl_idx, &bulk->val);
+  free_expr(&rest);
+  bulk->kind = BULK_REDUCE;
+  return self == 1 && extract_bulk_srcs(opt, bulk);
+}
+
+// fill, iota, copy, constant-offset-add and summation loops
+static int try_bulk_hor(Optimizer *opt, Stmt *stmt, DynArr *out) {
+  HorStmt *hor = &stmt->inner.hor;
+  Operand *var = &hor->var;
+  if (var->typ != OPERAND_INT_VAR ||
+      var->decl_idx >= opt->var_decls->item_cnts ||
+      hor->stmts.item_cnts != 1) {
+    return 0;
+  }
+  Stmt *body = hor->stmts.items;
+  if (body->typ != STMT_SET_CMD) {
+    return 0;
+  }
+  SetStmt *set = &body->inner.set;
+  Operand *dst = &set->operand;
+  unsigned short var_idx = var->decl_idx;
+  unsigned short dst_idx = dst->decl_idx;
+  int is_reduce = dst->typ == OPERAND_INT_VAR;
+  if (dst_idx >= opt->var_decls->item_cnts || dst_idx == var_idx ||
+      is_reduce == is_arr_decl(opt, dst_idx)) {
+    return 0;
+  }
+  // Bounds are evaluated once instead of per iteration
+  if (expr_refs_decl(&hor->start, var_idx) ||
+      expr_refs_decl(&hor->start, dst_idx) ||
+      expr_refs_decl(&hor->end, var_idx) ||
+      expr_refs_decl(&hor->end, dst_idx)) {
+    return 0;
+  }
+
+  Stmt bulk_stmt;
+  bulk_stmt.typ = STMT_BULK_LOOP;
+  bulk_stmt.line = stmt->line;
+  BulkStmt *bulk = &bulk_stmt.inner.bulk;
+  bulk->var = *var;
+  clone_expr(&bulk->start, &hor->start);
+  clone_expr(&bulk->end, &hor->end);
+  bulk->dst_idx = dst_idx;
+  init_const_expr(&bulk->dst_offset, 0);
+  da_init(&bulk->srcs, sizeof(BulkSrc), 2);
+  bulk->stride = 0;
+  init_const_expr(&bulk->val, 0);
+  int matched = is_reduce ? match_bulk_reduce(opt, bulk, set)
+                          : match_bulk_map(opt, bulk, set);
+  if (!matched || expr_refs_decl(&bulk->val, var_idx) ||
+      expr_refs_decl(&bulk->val, dst_idx)) {
+    free_stmt(&bulk_stmt);
+    return 0;
+  }
+  fold_bulk(bulk);
+  free_stmt(stmt);
+  *(Stmt *)da_try_push_back(out) = bulk_stmt;
+#ifndef NO_DEBUG
+  if (is_reduce) {
+    opt->stats.reductions++;
+  } else {
+    opt->stats.bulk_loops++;
+  }
+#endif
+  return 1;
+}
+
+static void opt_stmts(Optimizer *opt, DynArr *stmts) {
+  DynArr out;
+  da_init(&out, sizeof(Stmt), stmts->item_cnts ? stmts->item_cnts : 1);
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      fold_cond(&stmt->inner.ihu.cond);
+      if (try_fold_ihu(opt, stmt, &out)) {
+        continue;
+      }
+      opt_stmts(opt, &stmt->inner.ihu.stmts);
+      break;
+    case STMT_WHILE_BLK:
+      fold_cond(&stmt->inner.while_stmt.cond);
+      opt_stmts(opt, &stmt->inner.while_stmt.stmts);
+      break;
+    case STMT_HOR_BLK:
+      fold_operand(&stmt->inner.hor.var);
+      fold_expr(&stmt->inner.hor.start);
+      fold_expr(&stmt->inner.hor.end);
+      if (try_unroll_hor(opt, stmt, &out)) {
+        continue;
+      }
+      opt_stmts(opt, &stmt->inner.hor.stmts);
+      if (try_bulk_hor(opt, stmt, &out)) {
+        continue;
+      }
+      break;
+    case STMT_YOSORO_CMD:
+      fold_expr(&stmt->inner.yosoro.expr);
+      break;
+    case STMT_SET_CMD:
+      fold_operand(&stmt->inner.set.operand);
+      fold_expr(&stmt->inner.set.expr);
+      break;
+    case STMT_BULK_LOOP:
+      fold_bulk(&stmt->inner.bulk);
+      break;
+    }
+    *(Stmt *)da_try_push_back(&out) = *stmt;
+  }
+  da_free(stmts);
+  *stmts = out;
+}
+
+void optimizer_run(Optimizer *opt) { opt_stmts(opt, opt->stmts); }
+
+#ifndef NO_DEBUG
+void optimizer_stats(Optimizer *opt) {
+  struct OptimizerStats stats = opt->stats;
+  logger("Optimizer Stats:\n"
+         "Hor\n"
+         "  Unrolled: %zu\n"
+         "  Bulk    : %zu\n"
+         "  Reduced : %zu\n"
+         "Ihu\n"
+         "  Folded  : %zu\n",
+         stats.unrolled_hors, stats.bulk_loops, stats.reductions,
+         stats.folded_ihus);
+}
+#endif
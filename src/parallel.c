@@ -0,0 +1,540 @@
+#ifndef CODEGEN
+#ifdef PARALLEL
+
+#ifndef NO_CUSTOM_INC
+#include "parallel.h"
+#include "interpreter.h"
+#include "narrow.h"
+#include "parser.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+static const ValRange full_range = {INT_MIN, INT_MAX};
+static const ValRange empty_range = {1, 0};
+
+static ValRange hull(ValRange a, ValRange b) {
+  if (a.lo > a.hi) {
+    return b;
+  }
+  if (b.lo > b.hi) {
+    return a;
+  }
+  return (ValRange){a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi};
+}
+
+static int overlaps(ValRange a, ValRange b) {
+  return a.lo <= a.hi && b.lo <= b.hi && a.lo <= b.hi && b.lo <= a.hi;
+}
+
+// Indices past `int` wrap, so they may be anything
+static ValRange shift(ValRange range, ValRange offset) {
+  long long lo = range.lo + offset.lo;
+  long long hi = range.hi + offset.hi;
+  if (lo < INT_MIN || hi > INT_MAX) {
+    return full_range;
+  }
+  return (ValRange){lo, hi};
+}
+
+/* Access summaries */
+
+typedef struct LoopVar {
+  unsigned short decl_idx;
+  ValRange range;
+} LoopVar;
+
+typedef struct Summary {
+  Parallel *par;
+  ParTask *task;
+  DynArr killed; // char, per decl: written on every path so far
+  DynArr loops;  // LoopVar, of the enclosing `hor`s
+} Summary;
+
+static int is_declared(Summary *sum, unsigned short decl_idx) {
+  if (decl_idx < sum->par->var_decls->item_cnts) {
+    return 1;
+  }
+  sum->task->opaque = 1;
+  return 0;
+}
+
+static DeclAccess *decl_access(Summary *sum, unsigned short decl_idx) {
+  return (DeclAccess *)(sum->task->accesses.items) + decl_idx;
+}
+
+// The bounds of the innermost enclosing `hor` over it, if it is not
+// written in the body, else anything it ever holds
+static ValRange int_range(Summary *sum, unsigned short decl_idx) {
+  LoopVar *loop = sum->loops.items;
+  for (int i = sum->loops.item_cnts - 1; i >= 0; i--) {
+    if (loop[i].decl_idx == decl_idx) {
+      return loop[i].range;
+    }
+  }
+  return narrow_range(&sum->par->ranges, decl_idx);
+}
+
+static ValRange expr_range(Summary *sum, Expr *expr) {
+  long long lo = expr->constant;
+  long long hi = expr->constant;
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    Operand *operand = &op_term->operand;
+    ValRange range = operand->typ == OPERAND_INT_VAR
+                         ? int_range(sum, operand->decl_idx)
+                         : narrow_range(&sum->par->ranges, operand->decl_idx);
+    long long coef = op_term->coefficient;
+    long long a = range.lo * coef; // Both fit in 32 bits
+    long long b = range.hi * coef;
+    if (coef < 0) {
+      long long t = a;
+      a = b;
+      b = t;
+    }
+    if (__builtin_add_overflow(lo, a, &lo) ||
+        __builtin_add_overflow(hi, b, &hi)) {
+      return full_range;
+    }
+  }
+  if (lo < INT_MIN || hi > INT_MAX) {
+    return full_range;
+  }
+  return (ValRange){lo, hi};
+}
+
+static void read_expr(Summary *sum, Expr *expr);
+
+static void read_operand(Summary *sum, Operand *operand) {
+  if (!is_declared(sum, operand->decl_idx)) {
+    return;
+  }
+  DeclAccess *access = decl_access(sum, operand->decl_idx);
+  if (operand->typ == OPERAND_INT_VAR) {
+    if (!((char *)sum->killed.items)[operand->decl_idx]) {
+      access->read = 1;
+    }
+    return;
+  }
+  read_expr(sum, &operand->idx_expr);
+  access->rd = hull(access->rd, expr_range(sum, &operand->idx_expr));
+}
+
+static void read_expr(Summary *sum, Expr *expr) {
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    read_operand(sum, &op_term->operand);
+  }
+}
+
+static void read_cond(Summary *sum, Cond *cond) {
+  read_expr(sum, &cond->left);
+  read_expr(sum, &cond->right);
+}
+
+// An int that may keep its value on entry is read as well
+static void write_int(Summary *sum, unsigned short decl_idx, char certain) {
+  if (!is_declared(sum, decl_idx)) {
+    return;
+  }
+  DeclAccess *access = decl_access(sum, decl_idx);
+  char *killed = sum->killed.items;
+  access->write = 1;
+  if (certain) {
+    killed[decl_idx] = 1;
+  } else if (!killed[decl_idx]) {
+    access->read = 1;
+  }
+}
+
+static void write_arr(Summary *sum, unsigned short decl_idx, ValRange idx) {
+  if (is_declared(sum, decl_idx)) {
+    DeclAccess *access = decl_access(sum, decl_idx);
+    access->wr = hull(access->wr, idx);
+  }
+}
+
+static void write_operand(Summary *sum, Operand *operand, char certain) {
+  if (operand->typ == OPERAND_INT_VAR) {
+    write_int(sum, operand->decl_idx, certain);
+    return;
+  }
+  read_expr(sum, &operand->idx_expr);
+  write_arr(sum, operand->decl_idx, expr_range(sum, &operand->idx_expr));
+}
+
+// Both bounds are evaluated once, before the first pass
+static char runs_once(Summary *sum, Expr *start, Expr *end) {
+  return expr_range(sum, start).hi <= expr_range(sum, end).lo;
+}
+
+static ValRange walk_range(Summary *sum, Expr *start, Expr *end) {
+  return hull(expr_range(sum, start), expr_range(sum, end));
+}
+
+static void visit_stmts(Summary *sum, DynArr *stmts, char certain);
+
+static void visit_hor(Summary *sum, HorStmt *hor, char certain) {
+  read_expr(sum, &hor->start);
+  read_expr(sum, &hor->end);
+  char body_certain = certain && runs_once(sum, &hor->start, &hor->end);
+  ValRange walk = walk_range(sum, &hor->start, &hor->end);
+  write_operand(sum, &hor->var, body_certain);
+  Operand *var = &hor->var;
+  char pushed = var->typ == OPERAND_INT_VAR &&
+                !stmts_writes_decl(&hor->stmts, var->decl_idx);
+  if (pushed) {
+    LoopVar *loop = da_try_push_back(&sum->loops);
+    loop->decl_idx = var->decl_idx;
+    loop->range = walk;
+  }
+  visit_stmts(sum, &hor->stmts, body_certain);
+  if (pushed) {
+    sum->loops.item_cnts--;
+  }
+}
+
+// Like `execute_bulk`, which leaves everything alone when it does not run
+static void visit_bulk(Summary *sum, BulkStmt *bulk, char certain) {
+  read_expr(sum, &bulk->start);
+  read_expr(sum, &bulk->end);
+  read_expr(sum, &bulk->val);
+  read_expr(sum, &bulk->dst_offset);
+  ValRange walk = walk_range(sum, &bulk->start, &bulk->end);
+  BulkSrc *src = bulk->srcs.items;
+  for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+    read_expr(sum, &src->offset);
+    if (is_declared(sum, src->decl_idx)) {
+      DeclAccess *access = decl_access(sum, src->decl_idx);
+      access->rd =
+          hull(access->rd, shift(walk, expr_range(sum, &src->offset)));
+    }
+  }
+  if (bulk->kind == BULK_REDUCE) {
+    write_int(sum, bulk->dst_idx, 0); // Also adds to the value on entry
+  } else {
+    write_arr(sum, bulk->dst_idx,
+              shift(walk, expr_range(sum, &bulk->dst_offset)));
+  }
+  write_operand(sum, &bulk->var,
+                certain && runs_once(sum, &bulk->start, &bulk->end));
+}
+
+static void visit_stmts(Summary *sum, DynArr *stmts, char certain) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      read_cond(sum, &stmt->inner.ihu.cond);
+      visit_stmts(sum, &stmt->inner.ihu.stmts, 0);
+      break;
+    case STMT_WHILE_BLK:
+      read_cond(sum, &stmt->inner.while_stmt.cond);
+      visit_stmts(sum, &stmt->inner.while_stmt.stmts, 0);
+      break;
+    case STMT_HOR_BLK:
+      visit_hor(sum, &stmt->inner.hor, certain);
+      break;
+    case STMT_YOSORO_CMD:
+      read_expr(sum, &stmt->inner.yosoro.expr);
+      break;
+    case STMT_SET_CMD:
+      read_expr(sum, &stmt->inner.set.expr);
+      write_operand(sum, &stmt->inner.set.operand, certain);
+      break;
+    case STMT_BULK_LOOP:
+      visit_bulk(sum, &stmt->inner.bulk, certain);
+      break;
+    }
+  }
+}
+
+static void summarize_task(Parallel *par, ParTask *task) {
+  usize cnts = par->var_decls->item_cnts;
+  da_init(&task->accesses, sizeof(DeclAccess), cnts ? cnts : 1);
+  DeclAccess *access = da_pushs_back(&task->accesses, cnts);
+  for (usize i = 0; i < cnts; i++) {
+    access[i] = (DeclAccess){0, 0, empty_range, empty_range};
+  }
+  Summary sum = {par, task};
+  da_init(&sum.killed, sizeof(char), cnts ? cnts : 1);
+  memset(da_pushs_back(&sum.killed, cnts), 0, cnts);
+  da_init(&sum.loops, sizeof(LoopVar), 4);
+  visit_stmts(&sum, &(DynArr){task->stmt, sizeof(Stmt), 1, 1}, 1);
+  da_free(&sum.killed);
+  da_free(&sum.loops);
+}
+
+// `b` comes after `a` in the program
+static int tasks_conflict(Parallel *par, ParTask *a, ParTask *b) {
+  if (a->opaque || b->opaque) {
+    return 1;
+  }
+  DeclAccess *acc_a = a->accesses.items;
+  DeclAccess *acc_b = b->accesses.items;
+  VarDecl *decl = par->var_decls->items;
+  for (int i = 0; i < par->var_decls->item_cnts; i++) {
+    if (decl[i].typ == VAR_INT) {
+      // Ints are private, only a later read sees an earlier write
+      if (acc_a[i].write && acc_b[i].read) {
+        return 1;
+      }
+    } else if (overlaps(acc_a[i].wr, acc_b[i].rd) ||
+               overlaps(acc_a[i].rd, acc_b[i].wr) ||
+               overlaps(acc_a[i].wr, acc_b[i].wr)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int has_loop(DynArr *stmts) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_WHILE_BLK:
+    case STMT_HOR_BLK:
+    case STMT_BULK_LOOP:
+      return 1;
+    case STMT_IHU_BLK:
+      if (has_loop(&stmt->inner.ihu.stmts)) {
+        return 1;
+      }
+      break;
+    case STMT_YOSORO_CMD:
+    case STMT_SET_CMD:
+      break;
+    }
+  }
+  return 0;
+}
+
+void parallel_init(Parallel *par, DynArr *stmts, DynArr *var_decls) {
+  memset(par, 0, sizeof(Parallel));
+  par->stmts = stmts;
+  par->var_decls = var_decls;
+  narrow_init(&par->ranges, stmts, var_decls);
+  narrow_analyze(&par->ranges);
+  usize cnts = stmts->item_cnts;
+  da_init(&par->tasks, sizeof(ParTask), cnts ? cnts : 1);
+  Stmt *stmt = stmts->items;
+  for (usize i = 0; i < cnts; i++, stmt++) {
+    ParTask *task = da_try_push_back(&par->tasks);
+    memset(task, 0, sizeof(ParTask));
+    task->stmt = stmt;
+    summarize_task(par, task);
+  }
+  pthread_mutex_init(&par->pool.lock, NULL);
+  pthread_cond_init(&par->pool.work, NULL);
+  pthread_cond_init(&par->pool.done, NULL);
+}
+
+Parallel *parallel_create(DynArr *stmts, DynArr *var_decls) {
+  Parallel *par = malloc(sizeof(Parallel));
+  parallel_init(par, stmts, var_decls);
+  return par;
+}
+
+void parallel_free(Parallel *par) {
+  struct ParPool *pool = &par->pool;
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (usize i = 0; i < pool->thread_cnts; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->done);
+  ParTask *task = par->tasks.items;
+  for (int i = 0; i < par->tasks.item_cnts; i++, task++) {
+    da_free(&task->accesses);
+  }
+  da_free(&par->tasks);
+  narrow_free(&par->ranges);
+}
+
+/* Thread pool */
+
+static void run_task(ParTask *task) {
+  out_redirect(&task->output);
+  Interpreter interpreter;
+  interpreter_init(&interpreter, &(DynArr){task->stmt, sizeof(Stmt), 1, 1},
+                   &task->var_decls);
+  interpreter_execute(&interpreter);
+  interpreter_free(&interpreter);
+  out_redirect(NULL);
+}
+
+// Takes queued tasks until none is left, `lock` is held around the calls
+static void run_queued(Parallel *par) {
+  struct ParPool *pool = &par->pool;
+  while (pool->next < pool->end) {
+    ParTask *task = da_get(&par->tasks, pool->next++);
+    pthread_mutex_unlock(&pool->lock);
+    run_task(task);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+}
+
+static void *pool_worker(void *arg) {
+  Parallel *par = arg;
+  struct ParPool *pool = &par->pool;
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->stop) {
+    run_queued(par);
+    if (!pool->stop) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+// The calling thread takes tasks too
+static void pool_start(Parallel *par) {
+  struct ParPool *pool = &par->pool;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  usize cnts = cpus > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS
+               : cpus > 1                  ? cpus
+                                           : 1;
+  pool->threads = malloc(cnts * sizeof(pthread_t));
+  for (usize i = 0; i + 1 < cnts; i++) {
+    if (pthread_create(&pool->threads[i], NULL, pool_worker, par)) {
+      break;
+    }
+    pool->thread_cnts++;
+  }
+#ifndef NO_DEBUG
+  par->stats.threads = pool->thread_cnts + 1;
+#endif
+}
+
+/* Execution */
+
+static void run_serial(Parallel *par, usize begin, usize end) {
+  if (begin == end) {
+    return;
+  }
+  Interpreter interpreter;
+  interpreter_init(&interpreter,
+                   &(DynArr){da_get(par->stmts, begin), sizeof(Stmt),
+                             end - begin, end - begin},
+                   par->var_decls);
+  interpreter_execute(&interpreter);
+  interpreter_free(&interpreter);
+}
+
+// Each task starts from the ints on entry, the written ones are stored back
+// in program order, with the output
+static void run_group(Parallel *par, usize begin, usize end) {
+  struct ParPool *pool = &par->pool;
+  if (!pool->threads) {
+    pool_start(par);
+  }
+  usize cnts = par->var_decls->item_cnts;
+  for (usize i = begin; i < end; i++) {
+    ParTask *task = da_get(&par->tasks, i);
+    da_init(&task->var_decls, sizeof(VarDecl), cnts ? cnts : 1);
+    memcpy(da_pushs_back(&task->var_decls, cnts), par->var_decls->items,
+           cnts * sizeof(VarDecl));
+    da_init(&task->output, sizeof(char), 64);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->next = begin;
+  pool->end = end;
+  pool->pending = end - begin;
+  pthread_cond_broadcast(&pool->work);
+  run_queued(par);
+  while (pool->pending) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  VarDecl *decl = par->var_decls->items;
+  for (usize i = begin; i < end; i++) {
+    ParTask *task = da_get(&par->tasks, i);
+    out_write(task->output.items, task->output.item_cnts);
+    DeclAccess *access = task->accesses.items;
+    VarDecl *local = task->var_decls.items;
+    for (usize j = 0; j < cnts; j++) {
+      if (decl[j].typ == VAR_INT && access[j].write) {
+        decl[j].data.i.val = local[j].data.i.val;
+      }
+    }
+    da_free(&task->var_decls);
+    da_free(&task->output);
+  }
+}
+
+void parallel_execute(Parallel *par) {
+  ParTask *tasks = par->tasks.items;
+  usize cnts = par->tasks.item_cnts;
+  usize serial = 0; // Tasks `[serial, begin)` are still to run
+  usize begin = 0;
+  while (begin < cnts) {
+    // The longest run of pairwise independent statements
+    usize end = begin + 1;
+    while (end < cnts) {
+      usize i = begin;
+      while (i < end && !tasks_conflict(par, &tasks[i], &tasks[end])) {
+        i++;
+      }
+      if (i < end) {
+        break;
+      }
+      end++;
+    }
+    // Threads only pay off for at least two loops
+    usize loops = 0;
+    for (usize i = begin; i < end; i++) {
+      loops += has_loop(&(DynArr){tasks[i].stmt, sizeof(Stmt), 1, 1});
+    }
+#ifndef NO_DEBUG
+    par->stats.groups++;
+#endif
+    if (loops >= 2) {
+      run_serial(par, serial, begin);
+      run_group(par, begin, end);
+      serial = end;
+#ifndef NO_DEBUG
+      par->stats.parallel_groups++;
+      par->stats.parallel_tasks += end - begin;
+#endif
+    }
+    begin = end;
+  }
+  run_serial(par, serial, cnts);
+}
+
+#ifndef NO_DEBUG
+void parallel_stats(Parallel *par) {
+  struct ParallelStats stats = par->stats;
+  logger("Parallel Stats:\n"
+         "Statements : %u\n"
+         "Groups\n"
+         "  Total    : %zu\n"
+         "  Parallel : %zu\n"
+         "  Tasks    : %zu\n"
+         "Threads    : %zu\n",
+         par->tasks.item_cnts, stats.groups, stats.parallel_groups,
+         stats.parallel_tasks, stats.threads);
+}
+#endif
+
+#endif
+#endif
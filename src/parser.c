@@ -25,7 +25,15 @@ Parser *parser_create(DynArr *toks) {
   return parser;
 }
 
-void free_operand(Operand *op);
+static void free_term_soa(Expr *expr) {
+  if (!expr->soa) {
+    return;
+  }
+  free(expr->soa->coefs);
+  free(expr->soa->refs);
+  free(expr->soa);
+  expr->soa = NULL;
+}
 
 void free_expr(Expr *expr) {
   OperandTerm *op_term = expr->op_terms.items;
@@ -33,6 +41,7 @@ void free_expr(Expr *expr) {
     free_operand(&op_term->operand);
   }
   da_free(&expr->op_terms);
+  free_term_soa(expr);
 }
 
 void free_operand(Operand *op) {
@@ -41,35 +50,264 @@ void free_operand(Operand *op) {
   }
 }
 
+static void free_bounds_hoists(DynArr *hoists) {
+  if (!hoists) {
+    return;
+  }
+  BoundsHoist *hoist = hoists->items;
+  for (int i = 0; i < hoists->item_cnts; i++, hoist++) {
+    free_expr(&hoist->rest);
+  }
+  da_free(hoists);
+  free(hoists);
+}
+
+static void free_bulk_srcs(DynArr *srcs) {
+  BulkSrc *src = srcs->items;
+  for (int i = 0; i < srcs->item_cnts; i++, src++) {
+    free_expr(&src->offset);
+  }
+  da_free(srcs);
+}
+
+void free_stmt(Stmt *stmt) {
+  switch (stmt->typ) {
+  case STMT_YOSORO_CMD:
+    free_expr(&stmt->inner.yosoro.expr);
+    break;
+  case STMT_SET_CMD:
+    free_operand(&stmt->inner.set.operand);
+    free_expr(&stmt->inner.set.expr);
+    break;
+  case STMT_IHU_BLK:
+    free_expr(&stmt->inner.ihu.cond.left);
+    free_expr(&stmt->inner.ihu.cond.right);
+    free_stmts(&stmt->inner.ihu.stmts);
+    break;
+  case STMT_WHILE_BLK:
+    free_expr(&stmt->inner.while_stmt.cond.left);
+    free_expr(&stmt->inner.while_stmt.cond.right);
+    free_stmts(&stmt->inner.while_stmt.stmts);
+    break;
+  case STMT_HOR_BLK:
+    free_operand(&stmt->inner.hor.var);
+    free_expr(&stmt->inner.hor.start);
+    free_expr(&stmt->inner.hor.end);
+    free_stmts(&stmt->inner.hor.stmts);
+    free_bounds_hoists(stmt->inner.hor.hoists);
+    break;
+  case STMT_BULK_LOOP:
+    free_operand(&stmt->inner.bulk.var);
+    free_expr(&stmt->inner.bulk.start);
+    free_expr(&stmt->inner.bulk.end);
+    free_expr(&stmt->inner.bulk.dst_offset);
+    free_bulk_srcs(&stmt->inner.bulk.srcs);
+    free_expr(&stmt->inner.bulk.val);
+    break;
+  }
+}
+
 void free_stmts(DynArr *stmts) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    free_stmt(stmt);
+  }
+  da_free(stmts);
+}
+
+void clone_expr(Expr *dest, Expr *src) {
+  usize cnts = src->op_terms.item_cnts;
+  da_init(&dest->op_terms, sizeof(OperandTerm), cnts ? cnts : 1);
+  dest->constant = src->constant;
+  dest->shape = src->shape;
+  dest->soa = NULL; // Rebuilt when the clone is bound
+  OperandTerm *src_term = src->op_terms.items;
+  for (int i = 0; i < cnts; i++, src_term++) {
+    OperandTerm *dest_term = da_try_push_back(&dest->op_terms);
+    dest_term->coefficient = src_term->coefficient;
+    clone_operand(&dest_term->operand, &src_term->operand);
+  }
+}
+
+void clone_operand(Operand *dest, Operand *src) {
+  *dest = *src;
+  if (src->typ == OPERAND_ARR_ELEM) {
+    clone_expr(&dest->idx_expr, &src->idx_expr);
+  }
+}
+
+static void bind_expr(Expr *expr, DynArr *var_decls);
+
+static void bind_operand(Operand *operand, DynArr *var_decls) {
+  VarDecl *decl = (VarDecl *)(var_decls->items) + operand->decl_idx;
+  if (operand->typ == OPERAND_INT_VAR) {
+    operand->ref = &decl->data.i.val;
+    operand->width = ELEM_I32;
+    return;
+  }
+  // Biased, so that `ref[idx]` is the element
+  operand->width = decl->data.a.width;
+  switch (operand->width) {
+  case ELEM_I32:
+    operand->ref = decl->data.a.arr - decl->start;
+    break;
+  case ELEM_I16:
+    operand->ref16 = decl->data.a.arr16 - decl->start;
+    break;
+  case ELEM_I8:
+    operand->ref8 = decl->data.a.arr8 - decl->start;
+    break;
+  }
+  bind_expr(&operand->idx_expr, var_decls);
+}
+
+static void *alloc_vec_aligned(usize size) {
+  // `aligned_alloc` wants a multiple of the alignment
+  return aligned_alloc(32, (size + 31) & ~(usize)31);
+}
+
+static void build_term_soa(Expr *expr) {
+  usize cnts = expr->op_terms.item_cnts;
+  TermSoA *soa = malloc(sizeof(TermSoA));
+  soa->coefs = alloc_vec_aligned(cnts * sizeof(int));
+  soa->refs = alloc_vec_aligned(cnts * sizeof(int *));
+  soa->cnts = cnts;
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < cnts; i++, op_term++) {
+    soa->coefs[i] = op_term->coefficient;
+    soa->refs[i] = op_term->operand.ref;
+  }
+  expr->soa = soa;
+}
+
+static void bind_expr(Expr *expr, DynArr *var_decls) {
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    bind_operand(&op_term->operand, var_decls);
+  }
+  free_term_soa(expr);
+  if (expr->shape == EXPR_LINEAR &&
+      expr->op_terms.item_cnts >= EXPR_SOA_MIN_TERMS) {
+    build_term_soa(expr);
+  }
+}
+
+static void bind_bounds_hoists(DynArr *hoists, DynArr *var_decls) {
+  if (!hoists) {
+    return;
+  }
+  BoundsHoist *hoist = hoists->items;
+  for (int i = 0; i < hoists->item_cnts; i++, hoist++) {
+    bind_expr(&hoist->rest, var_decls);
+  }
+}
+
+static void bind_cond(Cond *cond, DynArr *var_decls) {
+  bind_expr(&cond->left, var_decls);
+  bind_expr(&cond->right, var_decls);
+}
+
+void bind_stmts(DynArr *stmts, DynArr *var_decls) {
   Stmt *stmt = stmts->items;
   for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
     switch (stmt->typ) {
-    case STMT_YOSORO_CMD:
-      free_expr(&stmt->inner.yosoro.expr);
-      break;
-    case STMT_SET_CMD:
-      free_operand(&stmt->inner.set.operand);
-      free_expr(&stmt->inner.set.expr);
-      break;
     case STMT_IHU_BLK:
-      free_expr(&stmt->inner.ihu.cond.left);
-      free_expr(&stmt->inner.ihu.cond.right);
-      free_stmts(&stmt->inner.ihu.stmts);
+      bind_cond(&stmt->inner.ihu.cond, var_decls);
+      bind_stmts(&stmt->inner.ihu.stmts, var_decls);
       break;
     case STMT_WHILE_BLK:
-      free_expr(&stmt->inner.while_stmt.cond.left);
-      free_expr(&stmt->inner.while_stmt.cond.right);
-      free_stmts(&stmt->inner.while_stmt.stmts);
+      bind_cond(&stmt->inner.while_stmt.cond, var_decls);
+      bind_stmts(&stmt->inner.while_stmt.stmts, var_decls);
       break;
     case STMT_HOR_BLK:
-      free_operand(&stmt->inner.hor.var);
-      free_expr(&stmt->inner.hor.start);
-      free_expr(&stmt->inner.hor.end);
-      free_stmts(&stmt->inner.hor.stmts);
+      bind_operand(&stmt->inner.hor.var, var_decls);
+      bind_expr(&stmt->inner.hor.start, var_decls);
+      bind_expr(&stmt->inner.hor.end, var_decls);
+      bind_stmts(&stmt->inner.hor.stmts, var_decls);
+      bind_bounds_hoists(stmt->inner.hor.hoists, var_decls);
+      break;
+    case STMT_YOSORO_CMD:
+      bind_expr(&stmt->inner.yosoro.expr, var_decls);
+      break;
+    case STMT_SET_CMD:
+      bind_operand(&stmt->inner.set.operand, var_decls);
+      bind_expr(&stmt->inner.set.expr, var_decls);
+      break;
+    case STMT_BULK_LOOP: {
+      BulkStmt *bulk = &stmt->inner.bulk;
+      bind_operand(&bulk->var, var_decls);
+      bind_expr(&bulk->start, var_decls);
+      bind_expr(&bulk->end, var_decls);
+      bind_expr(&bulk->dst_offset, var_decls);
+      BulkSrc *src = bulk->srcs.items;
+      for (int j = 0; j < bulk->srcs.item_cnts; j++, src++) {
+        bind_expr(&src->offset, var_decls);
+      }
+      bind_expr(&bulk->val, var_decls);
+    } break;
     }
   }
-  da_free(stmts);
+}
+
+static void clone_cond(Cond *dest, Cond *src) {
+  dest->typ = src->typ;
+  clone_expr(&dest->left, &src->left);
+  clone_expr(&dest->right, &src->right);
+}
+
+void clone_stmt(Stmt *dest, Stmt *src) {
+  dest->typ = src->typ;
+  dest->line = src->line;
+  switch (src->typ) {
+  case STMT_YOSORO_CMD:
+    clone_expr(&dest->inner.yosoro.expr, &src->inner.yosoro.expr);
+    break;
+  case STMT_SET_CMD:
+    clone_operand(&dest->inner.set.operand, &src->inner.set.operand);
+    clone_expr(&dest->inner.set.expr, &src->inner.set.expr);
+    break;
+  case STMT_IHU_BLK:
+    clone_cond(&dest->inner.ihu.cond, &src->inner.ihu.cond);
+    clone_stmts(&dest->inner.ihu.stmts, &src->inner.ihu.stmts);
+    break;
+  case STMT_WHILE_BLK:
+    clone_cond(&dest->inner.while_stmt.cond, &src->inner.while_stmt.cond);
+    clone_stmts(&dest->inner.while_stmt.stmts, &src->inner.while_stmt.stmts);
+    break;
+  case STMT_HOR_BLK:
+    clone_operand(&dest->inner.hor.var, &src->inner.hor.var);
+    clone_expr(&dest->inner.hor.start, &src->inner.hor.start);
+    clone_expr(&dest->inner.hor.end, &src->inner.hor.end);
+    clone_stmts(&dest->inner.hor.stmts, &src->inner.hor.stmts);
+    dest->inner.hor.hoists = NULL; // Rebuilt by the bounds pass
+    break;
+  case STMT_BULK_LOOP: {
+    BulkStmt *dest_bulk = &dest->inner.bulk;
+    BulkStmt *src_bulk = &src->inner.bulk;
+    *dest_bulk = *src_bulk;
+    clone_operand(&dest_bulk->var, &src_bulk->var);
+    clone_expr(&dest_bulk->start, &src_bulk->start);
+    clone_expr(&dest_bulk->end, &src_bulk->end);
+    clone_expr(&dest_bulk->dst_offset, &src_bulk->dst_offset);
+    da_init(&dest_bulk->srcs, sizeof(BulkSrc), src_bulk->srcs.capacity);
+    BulkSrc *bulk_src = src_bulk->srcs.items;
+    for (int i = 0; i < src_bulk->srcs.item_cnts; i++, bulk_src++) {
+      BulkSrc *dest_src = da_try_push_back(&dest_bulk->srcs);
+      *dest_src = *bulk_src;
+      clone_expr(&dest_src->offset, &bulk_src->offset);
+    }
+    clone_expr(&dest_bulk->val, &src_bulk->val);
+  } break;
+  }
+}
+
+void clone_stmts(DynArr *dest, DynArr *src) {
+  usize cnts = src->item_cnts;
+  da_init(dest, sizeof(Stmt), cnts ? cnts : 1);
+  Stmt *src_stmt = src->items;
+  for (int i = 0; i < cnts; i++, src_stmt++) {
+    clone_stmt(da_try_push_back(dest), src_stmt);
+  }
 }
 
 void parser_free_vars(Parser *parser) {
@@ -148,6 +386,7 @@ void parse_vars(Parser *parser) {
       consume_token(parser); // ..
       decl->end = atoi(next_token(parser)->str);
       decl->data.a.arr = calloc(decl->end - decl->start + 1, sizeof(int));
+      decl->data.a.width = ELEM_I32;
       consume_token(parser); // ]
     } // else ERR!
   }
@@ -177,6 +416,7 @@ void parse_operand(Parser *parser, Operand *operand) {
   consume_token(parser); // var_name
   // operand->decl_expand = UNEXPANDED;
   operand->typ = OPERAND_INT_VAR;
+  operand->unchecked = 0;
   if (match_token(parser, TOK_LBRACKET)) {
     operand->typ = OPERAND_ARR_ELEM;
     consume_token(parser); // [
@@ -192,8 +432,6 @@ void parse_operand(Parser *parser, Operand *operand) {
   //     (VarDecl *)(parser->var_decls.items) + decl_idx;
 }
 
-int is_operand_eq(Operand *a, Operand *b);
-
 int is_expr_eq(Expr *a, Expr *b) {
   // *Completely Equal*
   int cnts = a->op_terms.item_cnts;
@@ -203,7 +441,8 @@ int is_expr_eq(Expr *a, Expr *b) {
   OperandTerm *a_term = a->op_terms.items;
   OperandTerm *b_term = b->op_terms.items;
   for (int i = 0; i < cnts; i++, ++a_term, ++b_term) {
-    if (!is_operand_eq(&a_term->operand, &b_term->operand))
+    if (a_term->coefficient != b_term->coefficient ||
+        !is_operand_eq(&a_term->operand, &b_term->operand))
       return 0;
   }
   return 1;
@@ -220,6 +459,123 @@ int is_operand_eq(Operand *a, Operand *b) {
   }
 }
 
+int expr_refs_decl(Expr *expr, unsigned short decl_idx) {
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    if (operand_refs_decl(&op_term->operand, decl_idx)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int operand_refs_decl(Operand *operand, unsigned short decl_idx) {
+  if (operand->decl_idx == decl_idx) {
+    return 1;
+  }
+  return operand->typ == OPERAND_ARR_ELEM &&
+         expr_refs_decl(&operand->idx_expr, decl_idx);
+}
+
+static int cond_refs_decl(Cond *cond, unsigned short decl_idx) {
+  return expr_refs_decl(&cond->left, decl_idx) ||
+         expr_refs_decl(&cond->right, decl_idx);
+}
+
+static int bulk_refs_decl(BulkStmt *bulk, unsigned short decl_idx) {
+  if (bulk->dst_idx == decl_idx || operand_refs_decl(&bulk->var, decl_idx) ||
+      expr_refs_decl(&bulk->start, decl_idx) ||
+      expr_refs_decl(&bulk->end, decl_idx) ||
+      expr_refs_decl(&bulk->dst_offset, decl_idx) ||
+      expr_refs_decl(&bulk->val, decl_idx)) {
+    return 1;
+  }
+  BulkSrc *src = bulk->srcs.items;
+  for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+    if (src->decl_idx == decl_idx || expr_refs_decl(&src->offset, decl_idx)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Whether any statement reads or writes `decl_idx`
+int stmts_refs_decl(DynArr *stmts, unsigned short decl_idx) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    int refs = 0;
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      refs = cond_refs_decl(&stmt->inner.ihu.cond, decl_idx) ||
+             stmts_refs_decl(&stmt->inner.ihu.stmts, decl_idx);
+      break;
+    case STMT_WHILE_BLK:
+      refs = cond_refs_decl(&stmt->inner.while_stmt.cond, decl_idx) ||
+             stmts_refs_decl(&stmt->inner.while_stmt.stmts, decl_idx);
+      break;
+    case STMT_HOR_BLK:
+      refs = operand_refs_decl(&stmt->inner.hor.var, decl_idx) ||
+             expr_refs_decl(&stmt->inner.hor.start, decl_idx) ||
+             expr_refs_decl(&stmt->inner.hor.end, decl_idx) ||
+             stmts_refs_decl(&stmt->inner.hor.stmts, decl_idx);
+      break;
+    case STMT_YOSORO_CMD:
+      refs = expr_refs_decl(&stmt->inner.yosoro.expr, decl_idx);
+      break;
+    case STMT_SET_CMD:
+      refs = operand_refs_decl(&stmt->inner.set.operand, decl_idx) ||
+             expr_refs_decl(&stmt->inner.set.expr, decl_idx);
+      break;
+    case STMT_BULK_LOOP:
+      refs = bulk_refs_decl(&stmt->inner.bulk, decl_idx);
+      break;
+    }
+    if (refs) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Whether any statement may store to `decl_idx`
+int stmts_writes_decl(DynArr *stmts, unsigned short decl_idx) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK:
+      if (stmts_writes_decl(&stmt->inner.ihu.stmts, decl_idx)) {
+        return 1;
+      }
+      break;
+    case STMT_WHILE_BLK:
+      if (stmts_writes_decl(&stmt->inner.while_stmt.stmts, decl_idx)) {
+        return 1;
+      }
+      break;
+    case STMT_HOR_BLK:
+      if (stmt->inner.hor.var.decl_idx == decl_idx ||
+          stmts_writes_decl(&stmt->inner.hor.stmts, decl_idx)) {
+        return 1;
+      }
+      break;
+    case STMT_SET_CMD:
+      if (stmt->inner.set.operand.decl_idx == decl_idx) {
+        return 1;
+      }
+      break;
+    case STMT_BULK_LOOP:
+      if (stmt->inner.bulk.var.decl_idx == decl_idx ||
+          stmt->inner.bulk.dst_idx == decl_idx) {
+        return 1;
+      }
+      break;
+    case STMT_YOSORO_CMD:
+      break;
+    }
+  }
+  return 0;
+}
+
 void terms_add_operand(DynArr *op_terms, Operand op, int sign) {
   OperandTerm *op_term = op_terms->items;
   for (int i = 0; i < op_terms->item_cnts; i++, op_term++) {
@@ -272,11 +628,41 @@ static int compare_operand_terms(const void *a, const void *b) {
   return 0;
 }
 
+void classify_expr(Expr *expr) {
+  usize cnts = expr->op_terms.item_cnts;
+  OperandTerm *op_term = expr->op_terms.items;
+  for (int i = 0; i < cnts; i++) {
+    if (op_term[i].operand.typ != OPERAND_INT_VAR) {
+      expr->shape = EXPR_GENERAL;
+      return;
+    }
+  }
+  switch (cnts) {
+  case 0:
+    expr->shape = EXPR_CONST;
+    break;
+  case 1:
+    if (op_term->coefficient != 1) {
+      expr->shape = EXPR_LINEAR;
+    } else {
+      expr->shape = expr->constant ? EXPR_INT_OFFSET : EXPR_INT;
+    }
+    break;
+  case 2:
+    expr->shape = EXPR_INT2;
+    break;
+  default:
+    expr->shape = EXPR_LINEAR;
+    break;
+  }
+}
+
 void optimize_expr(Parser *parser, Expr *expr) {
   if (expr->op_terms.item_cnts > 1) {
     qsort(expr->op_terms.items, expr->op_terms.item_cnts, sizeof(OperandTerm),
           compare_operand_terms);
   }
+  classify_expr(expr);
   // // cut-off terms that coefficient=0
   // OperandTerm *op_term = expr->op_terms.items;
   // int end_i = 0;
@@ -290,6 +676,7 @@ void optimize_expr(Parser *parser, Expr *expr) {
 
 void parse_expr(Parser *parser, Expr *expr) {
   da_init(&expr->op_terms, sizeof(OperandTerm), 4);
+  expr->soa = NULL;
   DynArr *op_terms = &expr->op_terms;
   int const_val = 0;
   short sign = 1;
@@ -357,6 +744,7 @@ void parse_hor(Parser *parser, Stmt *stmt) {
   parse_expr(parser, &hor->start);
   consume_token(parser); // ,
   parse_expr(parser, &hor->end);
+  hor->hoists = NULL;
   da_init(&hor->stmts, sizeof(Stmt), 16);
   parse_blk(parser, &hor->stmts);
   consume_token(parser); // }
@@ -399,14 +787,17 @@ static void parse_stmts(Parser *parser, DynArr *stmts) {
       break;
     case TOK_KEYWORD_IHU:
       cur_stmt = da_try_push_back(stmts);
+      cur_stmt->line = tok->line;
       parse_ihu(parser, cur_stmt);
       break;
     case TOK_KEYWORD_WHILE:
       cur_stmt = da_try_push_back(stmts);
+      cur_stmt->line = tok->line;
       parse_while(parser, cur_stmt);
       break;
     case TOK_KEYWORD_HOR:
       cur_stmt = da_try_push_back(stmts);
+      cur_stmt->line = tok->line;
       parse_hor(parser, cur_stmt);
       break;
     default:
@@ -420,6 +811,7 @@ static void parse_stmts(Parser *parser, DynArr *stmts) {
       return;
     }
     cur_stmt = da_try_push_back(stmts);
+    cur_stmt->line = tok->line;
     switch (tok->type) {
     case TOK_KEYWORD_YOSORO:
       parse_yosoro(parser, cur_stmt);
@@ -556,6 +948,43 @@ void debug_stmt(Stmt *stmt, int indent) {
     debug_expr(&set->expr);
     printf(")\n");
   } break;
+  case STMT_BULK_LOOP: {
+    BulkStmt *bulk = &stmt->inner.bulk;
+    static const char *kinds[] = {
+        [BULK_FILL] = "Fill",
+        [BULK_IOTA] = "Iota",
+        [BULK_COPY] = "Copy",
+        [BULK_REDUCE] = "Reduce",
+    };
+    printf_indent(indent, "Bulk%s(", kinds[bulk->kind]);
+    debug_operand(&bulk->var);
+    printf(",");
+    debug_expr(&bulk->start);
+    printf(",");
+    debug_expr(&bulk->end);
+    printf("){#%hu", bulk->dst_idx);
+    if (bulk->kind != BULK_REDUCE) {
+      printf("[");
+      debug_expr(&bulk->dst_offset);
+      printf("]");
+    }
+    printf(" = ");
+    if (bulk->kind == BULK_REDUCE) {
+      printf("#%hu", bulk->dst_idx);
+    }
+    BulkSrc *src = bulk->srcs.items;
+    for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+      printf("%+d*#%hu[", src->coefficient, src->decl_idx);
+      debug_expr(&src->offset);
+      printf("]");
+    }
+    if (bulk->stride) {
+      printf("%+d*", bulk->stride);
+      debug_operand(&bulk->var);
+    }
+    debug_expr(&bulk->val);
+    printf("}\n");
+  } break;
   }
 }
 
@@ -0,0 +1,139 @@
+#if !defined(CODEGEN) || defined(PROFILE)
+#ifdef PROFILE
+
+#ifndef NO_CUSTOM_INC
+#include "profiler.h"
+#include "interpreter.h"
+#include "utils.h"
+#endif
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#define PROFILE_HEAT_WIDTH 10
+
+void profiler_init(Profiler *profiler, DynArr *flats) {
+  profiler->flats = flats;
+  usize cnts = flats->item_cnts;
+  da_init(&profiler->profiles, sizeof(StmtProfile), cnts ? cnts : 1);
+  memset(da_pushs_back(&profiler->profiles, cnts), 0,
+         cnts * sizeof(StmtProfile));
+  profiler->cur = 0;
+  profiler->last = profiler_clock();
+}
+
+void profiler_free(Profiler *profiler) { da_free(&profiler->profiles); }
+
+// Charges the tail of the run
+void profiler_stop(Profiler *profiler) {
+  uint64_t now = profiler_clock();
+  if (profiler->profiles.item_cnts) {
+    StmtProfile *profile = da_get(&profiler->profiles, profiler->cur);
+    profile->self += now - profiler->last;
+  }
+  profiler->last = now;
+}
+
+typedef struct LineProfile {
+  usize cnts; // Executions, entries for blocks
+  usize iters;
+  uint64_t self;
+  uint64_t total;
+  usize covered; // Flats before this are nested in a stmt of the line
+  char has_stmt;
+} LineProfile;
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+// Statements nested in another one on the same line are folded into it
+static void collect_lines(Profiler *profiler, LineProfile *lines,
+                          usize line_cnts, uint64_t *run_total) {
+  FlatStmt *flats = profiler->flats->items;
+  StmtProfile *profiles = profiler->profiles.items;
+  usize cnts = profiler->flats->item_cnts;
+  *run_total = 0;
+  for (usize i = 0; i < cnts; i++) {
+    *run_total += profiles[i].self;
+  }
+  for (usize i = 0; i < cnts; i++) {
+    FlatStmt *flat = &flats[i];
+    usize line = flat->stmt->line;
+    if (flat_is_loop_end(flat->typ) || line >= line_cnts) {
+      continue;
+    }
+    StmtProfile *profile = &profiles[i];
+    LineProfile *lp = &lines[line];
+    lp->has_stmt = 1;
+    lp->self += profile->self;
+    if (i < lp->covered) {
+      continue;
+    }
+    // Headers skip past their block, the others leave `jmp` at 0
+    usize end = flat->jmp > i ? flat->jmp : i + 1;
+    uint64_t total = 0;
+    for (usize j = i; j < end; j++) {
+      total += profiles[j].self;
+    }
+    lp->total += total;
+    lp->covered = end;
+    lp->iters += profile->iters;
+    // The back-edge of `while` re-enters its header
+    lp->cnts += flat->typ == FLAT_WHILE ? profile->hits - profile->iters
+                                        : profile->hits;
+  }
+}
+
+void profiler_report(Profiler *profiler, const char *src) {
+  usize line_cnts = 2; // 1-based, plus the last line
+  for (const char *ch = src; *ch; ch++) {
+    line_cnts += *ch == '\n';
+  }
+  LineProfile *lines = calloc(line_cnts, sizeof(LineProfile));
+  uint64_t run_total;
+  collect_lines(profiler, lines, line_cnts, &run_total);
+
+  fprintf(stderr, "Profile (%llu " PROFILE_UNIT "):\n",
+          (unsigned long long)run_total);
+  fprintf(stderr, "%10s %10s %7s %7s %-*s | %5s |\n", "count", "iters",
+          "self", "total", PROFILE_HEAT_WIDTH, "heat", "line");
+  const char *line_start = src;
+  for (usize line = 1; line < line_cnts && *line_start; line++) {
+    const char *line_end = strchr(line_start, '\n');
+    int len = line_end ? line_end - line_start : strlen(line_start);
+    LineProfile *lp = &lines[line];
+    if (lp->has_stmt) {
+      double self = percent(lp->self, run_total);
+      char heat[PROFILE_HEAT_WIDTH + 1];
+      int width = (self * PROFILE_HEAT_WIDTH + 50) / 100;
+      memset(heat, '#', width);
+      heat[width] = '\0';
+      fprintf(stderr, "%10u ", lp->cnts);
+      if (lp->iters) {
+        fprintf(stderr, "%10u ", lp->iters);
+      } else {
+        fprintf(stderr, "%10s ", "");
+      }
+      fprintf(stderr, "%6.2f%% %6.2f%% %-*s", self,
+              percent(lp->total, run_total), PROFILE_HEAT_WIDTH, heat);
+    } else {
+      fprintf(stderr, "%10s %10s %7s %7s %-*s", "", "", "", "",
+              PROFILE_HEAT_WIDTH, "");
+    }
+    fprintf(stderr, " | %5u | %.*s\n", line, len, line_start);
+    if (!line_end) {
+      break;
+    }
+    line_start = line_end + 1;
+  }
+  free(lines);
+}
+
+#endif
+#endif
@@ -0,0 +1,484 @@
+#ifdef CODEGEN
+#ifdef REGVM
+
+#ifndef NO_STD_INC
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+
+#ifndef NO_CUSTOM_INC
+#include "parser.h"
+#include "reggen.h"
+#include "utils.h"
+#endif
+
+void rg_init(RegGen *rg, DynArr *stmts, DynArr *var_decls) {
+  da_init(&rg->codes, sizeof(RegCode), 64);
+  da_init(&rg->consts, sizeof(int), 16);
+  rg->stmts = stmts;
+  rg->var_decls = var_decls;
+  rg->temps = 0;
+  rg->max_temps = 0;
+  rg->slot_cnts = 0;
+}
+
+RegGen *rg_create(DynArr *stmts, DynArr *var_decls) {
+  RegGen *rg = malloc(sizeof(RegGen));
+  rg_init(rg, stmts, var_decls);
+  return rg;
+}
+
+void rg_free(RegGen *rg) {
+  da_free(&rg->codes);
+  da_free(&rg->consts);
+}
+
+static const int slot_masks[] = {
+#undef REGOP
+#define REGOP(x, slots) [x] = slots,
+#include "regcodes.h"
+#undef REGOP
+};
+
+int rg_slot_mask(enum RegOpType typ) { return slot_masks[typ]; }
+
+static usize emit(RegGen *rg, enum RegOpType typ, reg_slot dst, reg_slot a,
+                  reg_slot b, int imm) {
+  RegCode *code = da_try_push_back(&rg->codes);
+  *code = (RegCode){typ, dst, a, b, imm};
+  return rg->codes.item_cnts - 1;
+}
+
+// Jumps are relative to themselves
+static void patch_jmp(RegGen *rg, usize jmp_idx, usize target) {
+  RegCode *jmp = da_get(&rg->codes, jmp_idx);
+  jmp->imm = (int)(target - jmp_idx);
+}
+
+static reg_slot new_temp(RegGen *rg) {
+  reg_slot slot = rg->var_decls->item_cnts + rg->temps++;
+  if (rg->temps > rg->max_temps) {
+    rg->max_temps = rg->temps;
+  }
+  return slot;
+}
+
+static reg_slot const_slot(RegGen *rg, int constant) {
+  int *consts = rg->consts.items;
+  for (usize i = 0; i < rg->consts.item_cnts; i++) {
+    if (consts[i] == constant) {
+      return REG_CONST_MARK + i;
+    }
+  }
+  if (rg->consts.item_cnts >= REG_CONST_MARK) {
+    // Out of slots, loaded where used
+    reg_slot temp = new_temp(rg);
+    emit(rg, ROP_MOVI, temp, 0, 0, constant);
+    return temp;
+  }
+  *(int *)da_try_push_back(&rg->consts) = constant;
+  return REG_CONST_MARK + rg->consts.item_cnts - 1;
+}
+
+static enum RegOpType arr_op_typ(RegGen *rg, unsigned short decl_idx,
+                                 int store) {
+  VarDecl *decl = (VarDecl *)(rg->var_decls->items) + decl_idx;
+  switch (decl->data.a.width) {
+  case ELEM_I16:
+    return store ? ROP_STA16 : ROP_LDA16;
+  case ELEM_I8:
+    return store ? ROP_STA8 : ROP_LDA8;
+  default:
+    return store ? ROP_STA : ROP_LDA;
+  }
+}
+
+static enum RegOpType cmp_op_typ(cmp_type cmp_typ) {
+  static const enum RegOpType cmp_ops[] = {
+      [CMP_LT] = ROP_JLT, [CMP_EQ] = ROP_JEQ,  [CMP_LE] = ROP_JLE,
+      [CMP_GT] = ROP_JGT, [CMP_NEQ] = ROP_JNE, [CMP_GE] = ROP_JGE,
+  };
+  return cmp_ops[cmp_typ];
+}
+
+static reg_slot gen_expr(RegGen *rg, Expr *expr);
+
+// The index slot is left in use
+static reg_slot gen_idx(RegGen *rg, Operand *operand) {
+  reg_slot idx = gen_expr(rg, &operand->idx_expr);
+#ifdef CHECKED
+  if (!operand->unchecked) {
+    emit(rg, ROP_CHECK, 0, operand->decl_idx, idx, 0);
+  }
+#endif
+  return idx;
+}
+
+static void gen_load_elem(RegGen *rg, Operand *operand, reg_slot dst) {
+  usize mark = rg->temps;
+  reg_slot idx = gen_idx(rg, operand);
+  emit(rg, arr_op_typ(rg, operand->decl_idx, 0), dst, operand->decl_idx, idx,
+       0);
+  rg->temps = mark;
+}
+
+// The slot of an int, or a temporary holding the element
+static reg_slot gen_load_operand(RegGen *rg, Operand *operand) {
+  if (operand->typ == OPERAND_INT_VAR) {
+    return operand->decl_idx;
+  }
+  reg_slot dst = new_temp(rg);
+  gen_load_elem(rg, operand, dst);
+  return dst;
+}
+
+static void gen_store_operand(RegGen *rg, Operand *operand, reg_slot src) {
+  if (operand->typ == OPERAND_INT_VAR) {
+    if (src != operand->decl_idx) {
+      emit(rg, ROP_MOV, operand->decl_idx, src, 0, 0);
+    }
+    return;
+  }
+  usize mark = rg->temps;
+  reg_slot idx = gen_idx(rg, operand);
+  emit(rg, arr_op_typ(rg, operand->decl_idx, 1), src, operand->decl_idx, idx,
+       0);
+  rg->temps = mark;
+}
+
+static int is_int_term(OperandTerm *op_term, reg_slot slot) {
+  return op_term->operand.typ == OPERAND_INT_VAR &&
+         op_term->operand.decl_idx == slot;
+}
+
+// Accumulates into `dst`, starting from its own term when it has one, so
+// `x = x + y` is a single `ADD`. The other terms must not read `dst`.
+static void gen_expr_into(RegGen *rg, Expr *expr, reg_slot dst) {
+  OperandTerm *op_term = expr->op_terms.items;
+  int cnts = expr->op_terms.item_cnts;
+  int first = -1;
+  for (int i = 0; i < cnts; i++) {
+    if (op_term[i].coefficient != 0 &&
+        (first < 0 || is_int_term(&op_term[i], dst))) {
+      first = i;
+    }
+    if (first >= 0 && is_int_term(&op_term[first], dst)) {
+      break;
+    }
+  }
+  if (first < 0) {
+    emit(rg, ROP_MOVI, dst, 0, 0, expr->constant);
+    return;
+  }
+  usize mark = rg->temps;
+  int constant = expr->constant;
+  int coef = op_term[first].coefficient;
+  // An element is read before `dst` is written, so it may go right there
+  reg_slot src = dst;
+  if (op_term[first].operand.typ == OPERAND_ARR_ELEM) {
+    gen_load_elem(rg, &op_term[first].operand, dst);
+  } else {
+    src = op_term[first].operand.decl_idx;
+  }
+  if (coef != 1) {
+    emit(rg, ROP_MULI, dst, src, 0, coef);
+  } else if (constant != 0) {
+    emit(rg, ROP_ADDI, dst, src, 0, constant);
+    constant = 0;
+  } else if (src != dst) {
+    emit(rg, ROP_MOV, dst, src, 0, 0);
+  }
+  rg->temps = mark;
+  for (int i = 0; i < cnts; i++) {
+    coef = op_term[i].coefficient;
+    if (i == first || coef == 0) {
+      continue;
+    }
+    src = gen_load_operand(rg, &op_term[i].operand);
+    if (coef == 1) {
+      emit(rg, ROP_ADD, dst, dst, src, 0);
+    } else {
+      emit(rg, ROP_ADDM, dst, dst, src, coef);
+    }
+    rg->temps = mark;
+  }
+  if (constant != 0) {
+    emit(rg, ROP_ADDI, dst, dst, 0, constant);
+  }
+}
+
+// Whether `x` is read by no term but at most one of its own
+static int accumulates_into(Expr *expr, unsigned short x) {
+  OperandTerm *op_term = expr->op_terms.items;
+  int own = 0;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    if (is_int_term(op_term, x)) {
+      own++;
+    } else if (operand_refs_decl(&op_term->operand, x)) {
+      return 0;
+    }
+  }
+  return own <= 1;
+}
+
+// Constants and lone vars are used in place, the rest gets a temporary
+static reg_slot gen_expr(RegGen *rg, Expr *expr) {
+  OperandTerm *op_term = expr->op_terms.items;
+  int terms = 0;
+  OperandTerm *single = NULL;
+  for (int i = 0; i < expr->op_terms.item_cnts; i++, op_term++) {
+    if (op_term->coefficient != 0) {
+      terms++;
+      single = op_term;
+    }
+  }
+  if (!terms) {
+    return const_slot(rg, expr->constant);
+  }
+  if (terms == 1 && single->coefficient == 1 && expr->constant == 0) {
+    return gen_load_operand(rg, &single->operand);
+  }
+  reg_slot dst = new_temp(rg);
+  gen_expr_into(rg, expr, dst);
+  return dst;
+}
+
+static void gen_set(RegGen *rg, Operand *operand, Expr *expr) {
+  usize mark = rg->temps;
+  if (operand->typ == OPERAND_INT_VAR &&
+      accumulates_into(expr, operand->decl_idx)) {
+    gen_expr_into(rg, expr, operand->decl_idx);
+  } else {
+    gen_store_operand(rg, operand, gen_expr(rg, expr));
+  }
+  rg->temps = mark;
+}
+
+static usize gen_cjmp(RegGen *rg, Cond *cond, cmp_type cmp_typ) {
+  usize mark = rg->temps;
+  reg_slot left = gen_expr(rg, &cond->left);
+  reg_slot right = gen_expr(rg, &cond->right);
+  rg->temps = mark;
+  return emit(rg, cmp_op_typ(cmp_typ), 0, left, right, 0);
+}
+
+// Consecutive temporaries holding `exprs`, left in use
+static reg_slot gen_args(RegGen *rg, Expr **exprs, int cnts) {
+  reg_slot base = new_temp(rg);
+  for (int i = 1; i < cnts; i++) {
+    new_temp(rg);
+  }
+  for (int i = 0; i < cnts; i++) {
+    gen_expr_into(rg, exprs[i], base + i);
+  }
+  return base;
+}
+
+#ifdef CHECKED
+// Preheader checks, before the loop variable is first stored
+static void gen_bounds_hoists(RegGen *rg, HorStmt *hor) {
+  if (!hor->hoists) {
+    return;
+  }
+  BoundsHoist *hoist = hor->hoists->items;
+  for (int i = 0; i < hor->hoists->item_cnts; i++, hoist++) {
+    usize mark = rg->temps;
+    Expr *args[] = {&hor->start, &hor->end, &hoist->rest};
+    reg_slot base = gen_args(rg, args, 3);
+    emit(rg, ROP_BOUNDS, 0, hoist->decl_idx, base, hoist->coefficient);
+    rg->temps = mark;
+  }
+}
+#endif
+
+static void gen_bulk(RegGen *rg, BulkStmt *bulk) {
+  usize mark = rg->temps;
+  // A zero-trip loop leaves the var alone, as a counted `hor` does
+  reg_slot start = gen_expr(rg, &bulk->start);
+  reg_slot end = gen_expr(rg, &bulk->end);
+  rg->temps = mark;
+  usize try_skip = emit(rg, ROP_JGT, 0, start, end, 0);
+  BulkSrc *src = bulk->srcs.items;
+  if (bulk->kind == BULK_REDUCE) {
+    reg_slot acc = bulk->dst_idx;
+    for (int i = 0; i < bulk->srcs.item_cnts; i++, src++) {
+      Expr *args[] = {&bulk->start, &bulk->end, &src->offset};
+      reg_slot base = gen_args(rg, args, 3);
+      reg_slot sum = new_temp(rg);
+      emit(rg, ROP_SUMA, sum, src->decl_idx, base, src->coefficient);
+      emit(rg, ROP_ADD, acc, acc, sum, 0);
+      rg->temps = mark;
+    }
+    Expr *args[] = {&bulk->start, &bulk->end, &bulk->val};
+    reg_slot base = gen_args(rg, args, 3);
+    reg_slot sum = new_temp(rg);
+    emit(rg, ROP_SERIES, sum, 0, base, bulk->stride);
+    emit(rg, ROP_ADD, acc, acc, sum, 0);
+  } else if (bulk->kind == BULK_COPY) {
+    Expr *args[] = {&bulk->start, &bulk->end, &bulk->dst_offset, &src->offset,
+                    &bulk->val};
+    reg_slot base = gen_args(rg, args, 5);
+    emit(rg, ROP_COPY, 0, bulk->dst_idx, base, src->decl_idx);
+  } else {
+    Expr *args[] = {&bulk->start, &bulk->end, &bulk->dst_offset, &bulk->val};
+    reg_slot base = gen_args(rg, args, 4);
+    emit(rg, bulk->kind == BULK_FILL ? ROP_FILL : ROP_IOTA, 0, bulk->dst_idx,
+         base, bulk->stride);
+  }
+  rg->temps = mark;
+  gen_set(rg, &bulk->var, &bulk->end);
+  patch_jmp(rg, try_skip, rg->codes.item_cnts);
+}
+
+static void gen_stmts(RegGen *rg, DynArr *stmts);
+
+// Same as the stack VM's FOR_INIT/FOR_NEXT: start and end are evaluated
+// once, and a zero-trip loop leaves the var alone
+static void gen_counted_hor(RegGen *rg, HorStmt *hor) {
+  reg_slot x = hor->var.decl_idx;
+  usize mark = rg->temps;
+  reg_slot start = gen_expr(rg, &hor->start);
+  reg_slot end = gen_expr(rg, &hor->end);
+  if (end < rg->var_decls->item_cnts) {
+    // A var the body may store to
+    reg_slot var_end = end;
+    end = new_temp(rg);
+    emit(rg, ROP_MOV, end, var_end, 0, 0);
+  }
+  usize try_skip = emit(rg, ROP_JGT, 0, start, end, 0);
+  if (start != x) {
+    emit(rg, ROP_MOV, x, start, 0, 0);
+  }
+  usize jmp_body = emit(rg, ROP_JMP, 0, 0, 0, 0);
+  usize next = emit(rg, ROP_ADDI, x, x, 0, 1);
+  patch_jmp(rg, jmp_body, rg->codes.item_cnts);
+  gen_stmts(rg, &hor->stmts);
+  // Stops on reaching the end, so an end of INT_MAX doesn't wrap
+  patch_jmp(rg, emit(rg, ROP_JLT, 0, x, end, 0), next);
+  patch_jmp(rg, try_skip, rg->codes.item_cnts);
+  rg->temps = mark;
+}
+
+// Otherwise the same shape as the stack VM: `end` is evaluated for every
+// test, and is the final value of the variable
+static void gen_hor(RegGen *rg, HorStmt *hor) {
+#ifdef CHECKED
+  gen_bounds_hoists(rg, hor);
+#endif
+  if (hor->var.typ == OPERAND_INT_VAR &&
+      !stmts_writes_decl(&hor->stmts, hor->var.decl_idx)) {
+    gen_counted_hor(rg, hor);
+    return;
+  }
+  gen_set(rg, &hor->var, &hor->start);
+  usize try_skip = emit(rg, ROP_JMP, 0, 0, 0, 0);
+  usize body = rg->codes.item_cnts;
+  gen_stmts(rg, &hor->stmts);
+  usize mark = rg->temps;
+  Operand *var = &hor->var;
+  if (var->typ == OPERAND_INT_VAR) {
+    emit(rg, ROP_ADDI, var->decl_idx, var->decl_idx, 0, 1);
+  } else {
+    reg_slot elem = gen_load_operand(rg, var);
+    emit(rg, ROP_ADDI, elem, elem, 0, 1);
+    gen_store_operand(rg, var, elem);
+  }
+  rg->temps = mark;
+  patch_jmp(rg, try_skip, rg->codes.item_cnts);
+  reg_slot cur = gen_load_operand(rg, var);
+  reg_slot end = gen_expr(rg, &hor->end);
+  patch_jmp(rg, emit(rg, ROP_JLE, 0, cur, end, 0), body);
+  rg->temps = mark;
+  gen_set(rg, var, &hor->end);
+}
+
+static void gen_stmts(RegGen *rg, DynArr *stmts) {
+  Stmt *stmt = stmts->items;
+  for (int i = 0; i < stmts->item_cnts; i++, stmt++) {
+    switch (stmt->typ) {
+    case STMT_IHU_BLK: {
+      IhuStmt *ihu = &stmt->inner.ihu;
+      usize try_skip = gen_cjmp(rg, &ihu->cond, ihu->cond.typ ^ 0b111);
+      gen_stmts(rg, &ihu->stmts);
+      patch_jmp(rg, try_skip, rg->codes.item_cnts);
+    } break;
+    case STMT_WHILE_BLK: {
+      WhileStmt *while_stmt = &stmt->inner.while_stmt;
+      usize jmp_cond = emit(rg, ROP_JMP, 0, 0, 0, 0);
+      usize body = rg->codes.item_cnts;
+      gen_stmts(rg, &while_stmt->stmts);
+      patch_jmp(rg, jmp_cond, rg->codes.item_cnts);
+      patch_jmp(rg, gen_cjmp(rg, &while_stmt->cond, while_stmt->cond.typ),
+                body);
+    } break;
+    case STMT_HOR_BLK:
+      gen_hor(rg, &stmt->inner.hor);
+      break;
+    case STMT_YOSORO_CMD: {
+      usize mark = rg->temps;
+      emit(rg, ROP_PUT, 0, gen_expr(rg, &stmt->inner.yosoro.expr), 0, 0);
+      rg->temps = mark;
+    } break;
+    case STMT_SET_CMD:
+      gen_set(rg, &stmt->inner.set.operand, &stmt->inner.set.expr);
+      break;
+    case STMT_BULK_LOOP:
+      gen_bulk(rg, &stmt->inner.bulk);
+      break;
+    }
+  }
+}
+
+// Constants go right after the temporaries
+static void place_consts(RegGen *rg) {
+  reg_slot base = rg->var_decls->item_cnts + rg->max_temps;
+  RegCode *code = rg->codes.items;
+  for (usize i = 0; i < rg->codes.item_cnts; i++, code++) {
+    int mask = slot_masks[code->typ];
+    if ((mask & RS_DST) && code->dst >= REG_CONST_MARK) {
+      code->dst += base - REG_CONST_MARK;
+    }
+    if ((mask & RS_A) && code->a >= REG_CONST_MARK) {
+      code->a += base - REG_CONST_MARK;
+    }
+    if ((mask & RS_B) && code->b >= REG_CONST_MARK) {
+      code->b += base - REG_CONST_MARK;
+    }
+  }
+  rg->slot_cnts = base + rg->consts.item_cnts;
+}
+
+void rg_gen(RegGen *rg) {
+  gen_stmts(rg, rg->stmts);
+  emit(rg, ROP_HALT, 0, 0, 0, 0);
+  place_consts(rg);
+}
+
+#ifndef NO_DEBUG
+const char *reg_op_type(enum RegOpType typ) {
+  switch (typ) {
+#undef REGOP
+#define REGOP(x, slots)                                                        \
+  case x:                                                                      \
+    return #x;
+#include "regcodes.h"
+#undef REGOP
+  default:
+    return "<Invalid>";
+  }
+}
+
+void rg_debug(RegGen *rg) {
+  printf("Slots: %u vars, %u temps, %u consts\n",
+         rg->var_decls->item_cnts, rg->max_temps, rg->consts.item_cnts);
+  RegCode *code = rg->codes.items;
+  for (int i = 0; i < rg->codes.item_cnts; i++, code++) {
+    printf("[%d] = %s(dst: %hu, a: %hu, b: %hu, imm: %d)\n", i,
+           reg_op_type(code->typ), code->dst, code->a, code->b, code->imm);
+  }
+}
+#endif
+
+#endif
+#endif
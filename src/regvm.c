@@ -0,0 +1,254 @@
+#ifdef CODEGEN
+#ifdef REGVM
+
+#ifndef NO_STD_INC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#ifndef NO_CUSTOM_INC
+#include "kernels.h"
+#include "parser.h"
+#include "reggen.h"
+#include "regvm.h"
+#include "utils.h"
+#include "vm.h"
+#endif
+
+#ifdef CHECKED
+#ifndef NO_CUSTOM_INC
+#include "bounds.h"
+#endif
+#endif
+
+void reg_vm_init(RegVM *vm, DynArr *var_decls, RegGen *rg) {
+  vm->var_decls = var_decls;
+  vm->rg = rg;
+}
+
+RegVM *reg_vm_create(DynArr *var_decls, RegGen *rg) {
+  RegVM *vm = malloc(sizeof(RegVM));
+  reg_vm_init(vm, var_decls, rg);
+  return vm;
+}
+
+// Biased by the array start, so that `base[idx]` is the element
+static void *arr_base(VarDecl *decl) {
+  VarArrData *arr_data = &decl->data.a;
+  switch (arr_data->width) {
+  case ELEM_I16:
+    return arr_data->arr16 - decl->start;
+  case ELEM_I8:
+    return arr_data->arr8 - decl->start;
+  default:
+    return arr_data->arr - decl->start;
+  }
+}
+
+// First of the `cnts` elements a bulk kernel touches
+static int *bulk_arr_ref(VarDecl *decl, int idx, usize cnts) {
+#ifdef CHECKED
+  bounds_check_range(decl, idx, cnts);
+#endif
+  return &decl->data.a.arr[idx - decl->start];
+}
+
+#ifndef NO_DEBUG
+#define REG_TRACE()                                                            \
+  cnts++;                                                                      \
+  printf("%s\n", reg_op_type(pc->typ))
+#else
+#define REG_TRACE()
+#endif
+
+#ifdef VM_THREADED
+#define REG_CASE(op) do_##op:
+#define REG_DISPATCH()                                                         \
+  REG_TRACE();                                                                 \
+  goto **label
+#define REG_NEXT(n)                                                            \
+  do {                                                                         \
+    int off = (n);                                                             \
+    pc += off;                                                                 \
+    label += off;                                                              \
+    REG_DISPATCH();                                                            \
+  } while (0)
+#else
+#define REG_CASE(op) case op:
+#define REG_NEXT(n)                                                            \
+  pc += (n);                                                                   \
+  continue
+#endif
+
+#define R(x) r[pc->x]
+#define ARGS (&r[pc->b])
+#define ARGS_CNTS ((unsigned)ARGS[1] - (unsigned)ARGS[0] + 1)
+#define JMP_IF(cond) REG_NEXT((cond) ? pc->imm : 1)
+
+void reg_vm_execute(RegVM *vm) {
+  RegGen *rg = vm->rg;
+  VarDecl *decls = vm->var_decls->items;
+  usize decl_cnts = vm->var_decls->item_cnts;
+  int *r = calloc(rg->slot_cnts ? rg->slot_cnts : 1, sizeof(int));
+  void **bases = malloc((decl_cnts ? decl_cnts : 1) * sizeof(void *));
+  for (usize i = 0; i < decl_cnts; i++) {
+    if (decls[i].typ == VAR_INT) {
+      r[i] = decls[i].data.i.val;
+    } else {
+      bases[i] = arr_base(&decls[i]);
+    }
+  }
+  memcpy(r + decl_cnts + rg->max_temps, rg->consts.items,
+         rg->consts.item_cnts * sizeof(int));
+  RegCode *codes = rg->codes.items;
+  RegCode *pc = codes;
+#ifndef NO_DEBUG
+  int cnts = 0;
+#endif
+#ifdef VM_THREADED
+  static const void *const labels[] = {
+#undef REGOP
+#define REGOP(x, slots) [x] = &&do_##x,
+#include "regcodes.h"
+#undef REGOP
+  };
+  usize code_cnts = rg->codes.item_cnts;
+  const void **thread = malloc(code_cnts * sizeof(void *));
+  for (usize i = 0; i < code_cnts; i++) {
+    thread[i] = labels[codes[i].typ];
+  }
+  const void **label = thread;
+  REG_DISPATCH();
+#else
+  while (1) {
+    REG_TRACE();
+    switch (pc->typ) {
+#endif
+  REG_CASE(ROP_MOV)
+    R(dst) = R(a);
+    REG_NEXT(1);
+  REG_CASE(ROP_MOVI)
+    R(dst) = pc->imm;
+    REG_NEXT(1);
+  REG_CASE(ROP_ADD)
+    R(dst) = (unsigned)R(a) + (unsigned)R(b);
+    REG_NEXT(1);
+  REG_CASE(ROP_ADDI)
+    R(dst) = (unsigned)R(a) + (unsigned)pc->imm;
+    REG_NEXT(1);
+  REG_CASE(ROP_MULI)
+    R(dst) = (unsigned)R(a) * (unsigned)pc->imm;
+    REG_NEXT(1);
+  REG_CASE(ROP_ADDM)
+    R(dst) = (unsigned)R(a) + (unsigned)R(b) * (unsigned)pc->imm;
+    REG_NEXT(1);
+  REG_CASE(ROP_LDA)
+    R(dst) = ((int *)bases[pc->a])[R(b)];
+    REG_NEXT(1);
+  REG_CASE(ROP_LDA16)
+    R(dst) = ((short *)bases[pc->a])[R(b)];
+    REG_NEXT(1);
+  REG_CASE(ROP_LDA8)
+    R(dst) = ((signed char *)bases[pc->a])[R(b)];
+    REG_NEXT(1);
+  REG_CASE(ROP_STA)
+    ((int *)bases[pc->a])[R(b)] = R(dst);
+    REG_NEXT(1);
+  REG_CASE(ROP_STA16)
+    ((short *)bases[pc->a])[R(b)] = R(dst);
+    REG_NEXT(1);
+  REG_CASE(ROP_STA8)
+    ((signed char *)bases[pc->a])[R(b)] = R(dst);
+    REG_NEXT(1);
+  REG_CASE(ROP_JMP)
+    REG_NEXT(pc->imm);
+  REG_CASE(ROP_JLT)
+    JMP_IF(R(a) < R(b));
+  REG_CASE(ROP_JEQ)
+    JMP_IF(R(a) == R(b));
+  REG_CASE(ROP_JLE)
+    JMP_IF(R(a) <= R(b));
+  REG_CASE(ROP_JGT)
+    JMP_IF(R(a) > R(b));
+  REG_CASE(ROP_JNE)
+    JMP_IF(R(a) != R(b));
+  REG_CASE(ROP_JGE)
+    JMP_IF(R(a) >= R(b));
+  REG_CASE(ROP_PUT)
+    print_num(R(a));
+    REG_NEXT(1);
+  REG_CASE(ROP_CHECK)
+#ifdef CHECKED
+    bounds_check(&decls[pc->a], R(b));
+#endif
+    REG_NEXT(1);
+  REG_CASE(ROP_BOUNDS)
+#ifdef CHECKED
+    if (ARGS[0] <= ARGS[1]) {
+      bounds_check_hoist(&decls[pc->a], pc->imm, ARGS[0], ARGS[1], ARGS[2]);
+    }
+#endif
+    REG_NEXT(1);
+  REG_CASE(ROP_FILL)
+    if (ARGS[0] <= ARGS[1]) {
+      bulk_fill(bulk_arr_ref(&decls[pc->a], ARGS[0] + ARGS[2], ARGS_CNTS),
+                ARGS_CNTS, ARGS[3]);
+    }
+    REG_NEXT(1);
+  REG_CASE(ROP_IOTA)
+    if (ARGS[0] <= ARGS[1]) {
+      bulk_iota(bulk_arr_ref(&decls[pc->a], ARGS[0] + ARGS[2], ARGS_CNTS),
+                ARGS_CNTS, (unsigned)pc->imm * ARGS[0] + ARGS[3], pc->imm);
+    }
+    REG_NEXT(1);
+  REG_CASE(ROP_COPY)
+    if (ARGS[0] <= ARGS[1]) {
+      bulk_copy(bulk_arr_ref(&decls[pc->a], ARGS[0] + ARGS[2], ARGS_CNTS),
+                bulk_arr_ref(&decls[pc->imm], ARGS[0] + ARGS[3], ARGS_CNTS),
+                ARGS_CNTS, ARGS[4]);
+    }
+    REG_NEXT(1);
+  REG_CASE(ROP_SUMA) {
+    int sum = 0;
+    if (ARGS[0] <= ARGS[1]) {
+      sum = bulk_sum(
+          bulk_arr_ref(&decls[pc->a], ARGS[0] + ARGS[2], ARGS_CNTS),
+          ARGS_CNTS);
+    }
+    R(dst) = (unsigned)pc->imm * sum;
+    REG_NEXT(1);
+  }
+  REG_CASE(ROP_SERIES) {
+    int sum = 0;
+    if (ARGS[0] <= ARGS[1]) {
+      sum = bulk_series_sum(ARGS[0], ARGS_CNTS, pc->imm, ARGS[2]);
+    }
+    R(dst) = sum;
+    REG_NEXT(1);
+  }
+  REG_CASE(ROP_HALT)
+#ifndef NO_DEBUG
+    printf("Dispatched commands of %d(100%%)\n", cnts);
+#endif
+    for (usize i = 0; i < decl_cnts; i++) {
+      if (decls[i].typ == VAR_INT) {
+        decls[i].data.i.val = r[i];
+      }
+    }
+#ifdef VM_THREADED
+    free(thread);
+#endif
+    free(bases);
+    free(r);
+    return;
+#ifndef VM_THREADED
+    default:
+      __builtin_unreachable();
+    }
+  }
+#endif
+}
+
+#endif
+#endif
@@ -48,7 +48,11 @@ void err_log(const char *fmt, ...) {
 
 int da_init_call_cnts = 0;
 void da_init(DynArr *dyn_arr, usize item_size, usize capacity) {
+#ifdef PARALLEL
+  __atomic_fetch_add(&da_init_call_cnts, 1, __ATOMIC_RELAXED); // Pool threads
+#else
   da_init_call_cnts++;
+#endif
   dyn_arr->item_cnts = 0;
   dyn_arr->capacity = capacity;
   dyn_arr->item_size = item_size;
@@ -73,6 +77,40 @@ void *da_push_back(DynArr *dyn_arr, void *item) {
 
 void da_free(DynArr *dyn_arr) { free(dyn_arr->items); }
 
+#ifdef RESULT_CACHE
+static DynArr *out_capture_buf = NULL;
+
+void out_capture(DynArr *buf) { out_capture_buf = buf; }
+#endif
+
+#ifdef PARALLEL
+// Blocks run by the parallel scheduler buffer their own output
+static _Thread_local DynArr *out_redirect_buf = NULL;
+
+void out_redirect(DynArr *buf) { out_redirect_buf = buf; }
+#endif
+
+void out_write(const char *str, usize len) {
+  fwrite(str, 1, len, stdout);
+#ifdef RESULT_CACHE
+  if (out_capture_buf) {
+    memcpy(da_pushs_back(out_capture_buf, len), str, len);
+  }
+#endif
+}
+
+void print_num(int num) {
+  char buf[16];
+  int len = snprintf(buf, sizeof(buf), "%d ", num);
+#ifdef PARALLEL
+  if (out_redirect_buf) {
+    memcpy(da_pushs_back(out_redirect_buf, len), buf, len);
+    return;
+  }
+#endif
+  out_write(buf, len);
+}
+
 void str_pool_init(StrPool *pool, usize mempool_size, usize capacity) {
   pool->mempool_size = mempool_size;
   pool->mempool = malloc(mempool_size);
@@ -7,101 +7,193 @@
 
 #ifndef NO_CUSTOM_INC
 #include "codegen.h"
+#include "kernels.h"
 #include "parser.h"
 #include "utils.h"
 #include "vm.h"
 #endif
 
-void stack_init(Stack *stack) {
-  int capacity = sizeof(stack->bottom) / sizeof(*stack->bottom);
+#ifdef CHECKED
+#ifndef NO_CUSTOM_INC
+#include "bounds.h"
+#endif
+#endif
+
+// `max_depth` is proven by codegen, no push ever needs a check
+void stack_init(Stack *stack, int max_depth) {
+  int capacity = max_depth + 1; // And the free slot under the entries
   stack->capacity = capacity;
-  // stack->bottom = malloc(stack->capacity);
+  stack->bottom = malloc(capacity * sizeof(int));
   stack->top = stack->bottom + capacity - 1;
+  stack->tos = 0;
 }
 
-void stack_check_capacity(
-    Stack *stack) { // 太过神奇了，没有这个“无用函数”反而速度会变慢
-  if (stack->top >= stack->bottom + stack->capacity) {
-    printf("Stack Overflow!");
-    // int diff = stack->top - stack->bottom;
-    // stack->capacity *= 2;
-    // stack->bottom = realloc(stack->bottom, stack->capacity);
-    // stack->top = stack->bottom + diff;
-  }
-}
+void stack_free(Stack *stack) { free(stack->bottom); }
 
-void stack_push(Stack *stack, int data) {
-  // stack_check_capacity(stack);
-  *stack->top-- = data;
-}
-int stack_pop(Stack *stack) {
-  // stack_check_capacity(stack);
-  return *++stack->top;
-}
+void stack_push(Stack *stack, int data) { *stack->top-- = data; }
+int stack_pop(Stack *stack) { return *++stack->top; }
 
-void cyr_vm_init(CyrVM *cyr_vm, DynArr *var_decls, DynArr *codes) {
+void cyr_vm_init(CyrVM *cyr_vm, DynArr *var_decls, DynArr *codes,
+                 DynArr *lin_terms, int max_depth) {
   cyr_vm->codes = codes;
   cyr_vm->var_decls = var_decls;
+  cyr_vm->decls = var_decls->items;
+  cyr_vm->lin_terms = lin_terms->items;
+  cyr_vm->max_depth = max_depth;
 }
 
-CyrVM *cyr_vm_create(DynArr *var_decls, DynArr *codes) {
+CyrVM *cyr_vm_create(DynArr *var_decls, DynArr *codes, DynArr *lin_terms,
+                     int max_depth) {
   CyrVM *cyr_vm = malloc(sizeof(CyrVM));
-  cyr_vm_init(cyr_vm, var_decls, codes);
+  cyr_vm_init(cyr_vm, var_decls, codes, lin_terms, max_depth);
   return cyr_vm;
 }
 
+VarDecl *decl_ref(CyrVM *vm, unsigned decl_idx) {
+  return vm->decls + decl_idx;
+}
+
 int *arr_ref(VarDecl *decl, int idx) {
-  // VarDecl *decl = decl_idx + (VarDecl *)vm->var_decls->items;
   return &decl->data.a.arr[idx - decl->start];
 }
 
-int *int_ref(VarDecl *decl) {
-  // VarDecl *decl = decl_idx + (VarDecl *)vm->var_decls->items;
-  return &decl->data.i.val;
+short *arr16_ref(VarDecl *decl, int idx) {
+  return &decl->data.a.arr16[idx - decl->start];
+}
+
+signed char *arr8_ref(VarDecl *decl, int idx) {
+  return &decl->data.a.arr8[idx - decl->start];
 }
 
-typedef short (*vm_handler)(CyrVM *vm, Stack *stack, union OpCodeData dat);
-#define DECL_VM_HANDLE(x) short x(CyrVM *vm, Stack *stack, union OpCodeData dat)
+int *int_ref(CyrVM *vm, unsigned decl_idx) {
+  return &decl_ref(vm, decl_idx)->data.i.val;
+}
+
+// Handlers return the offset to the next instruction
+typedef int (*vm_handler)(CyrVM *vm, Stack *stack, OpCode op);
+#define DECL_VM_HANDLE(x) int x(CyrVM *vm, Stack *stack, OpCode op)
+
+// The previous top, spilled to its own slot
+#define SPILL_TOS() (stack->top[2] = stack->tos)
 
 DECL_VM_HANDLE(load_const) {
-  stack->top[1] = dat.constant;
+  SPILL_TOS();
+  stack->tos = op.imm;
+  return 1;
+}
+
+DECL_VM_HANDLE(load_const_e) {
+  stack->tos = op.imm;
   return 1;
 }
 
 DECL_VM_HANDLE(load_int) {
-  // stack->top[1] = *int_ref(vm, dat.decl_idx);
-  stack->top[1] = *int_ref(dat.ptr);
+  SPILL_TOS();
+  stack->tos = *int_ref(vm, op.slot);
+  return 1;
+}
+
+DECL_VM_HANDLE(load_int_e) {
+  stack->tos = *int_ref(vm, op.slot);
   return 1;
 }
 
 DECL_VM_HANDLE(load_arr) {
-  int idx = stack->top[1];
-  // stack->top[1] = *arr_ref(vm, dat.decl_idx, idx);
-  stack->top[1] = *arr_ref(dat.ptr, idx);
+  stack->tos = *arr_ref(decl_ref(vm, op.slot), stack->tos);
   return 1;
 }
 
+// Stores, PUT, CJMP and SWITCH end their statement, they leave the stack
+// empty and never refill the top
+
 DECL_VM_HANDLE(store_int) {
-  // *int_ref(vm, dat.decl_idx) = stack->top[0];
-  *int_ref(dat.ptr) = stack->top[0];
+  *int_ref(vm, op.slot) = stack->tos;
   return 1;
 }
 
 DECL_VM_HANDLE(store_arr) {
-  int idx = stack->top[-1];
-  // *arr_ref(vm, dat.decl_idx, idx) = stack->top[0];
-  *arr_ref(dat.ptr, idx) = stack->top[0];
+  *arr_ref(decl_ref(vm, op.slot), stack->tos) = stack->top[0];
+  return 1;
+}
+
+DECL_VM_HANDLE(load_arr16) {
+  stack->tos = *arr16_ref(decl_ref(vm, op.slot), stack->tos);
+  return 1;
+}
+
+DECL_VM_HANDLE(load_arr8) {
+  stack->tos = *arr8_ref(decl_ref(vm, op.slot), stack->tos);
+  return 1;
+}
+
+DECL_VM_HANDLE(store_arr16) {
+  *arr16_ref(decl_ref(vm, op.slot), stack->tos) = stack->top[0];
+  return 1;
+}
+
+DECL_VM_HANDLE(store_arr8) {
+  *arr8_ref(decl_ref(vm, op.slot), stack->tos) = stack->top[0];
+  return 1;
+}
+
+// Narrowed arrays are read and written at their own width
+static int load_elem(VarDecl *decl, int idx) {
+  switch (decl->data.a.width) {
+  case ELEM_I16:
+    return *arr16_ref(decl, idx);
+  case ELEM_I8:
+    return *arr8_ref(decl, idx);
+  default:
+    return *arr_ref(decl, idx);
+  }
+}
+
+static void store_elem(VarDecl *decl, int idx, int val) {
+  switch (decl->data.a.width) {
+  case ELEM_I16:
+    *arr16_ref(decl, idx) = val;
+    break;
+  case ELEM_I8:
+    *arr8_ref(decl, idx) = val;
+    break;
+  default:
+    *arr_ref(decl, idx) = val;
+    break;
+  }
+}
+
+DECL_VM_HANDLE(inca) {
+  VarDecl *decl = decl_ref(vm, op.slot);
+  store_elem(decl, stack->tos, load_elem(decl, stack->tos) + op.imm);
+  return 1;
+}
+
+DECL_VM_HANDLE(adda) {
+  VarDecl *decl = decl_ref(vm, op.slot);
+  store_elem(decl, stack->tos, load_elem(decl, stack->tos) + stack->top[0]);
+  return 1;
+}
+
+DECL_VM_HANDLE(seta) {
+  store_elem(decl_ref(vm, op.slot), stack->tos, op.imm);
   return 1;
 }
 
 DECL_VM_HANDLE(seti) {
-  // *int_ref(vm, dat.var_const.decl_idx) = dat.var_const.constant;
-  *int_ref(dat.var_const.ptr) = dat.var_const.constant;
+  *int_ref(vm, op.slot) = op.imm;
   return 1;
 }
 
-DECL_VM_HANDLE(jmp) { return dat.offset; }
+DECL_VM_HANDLE(jmp) { return op.imm; }
+
+// Offset of the table entry to take
+DECL_VM_HANDLE(switch_idx) {
+  unsigned idx = (unsigned)stack->tos - (unsigned)op.imm;
+  return 1 + (idx < op.slot ? idx : op.slot);
+}
 
+// Profiled builds link the interpreter, which brings its own do_cmp
+#ifndef PROFILE
 char do_cmp(cmp_type cond_typ, int left, int right) {
   // Assume it always within range ...
   // if (cond_typ < 0 || cond_typ >= 6)
@@ -120,12 +212,36 @@ char do_cmp(cmp_type cond_typ, int left, int right) {
   const char ge = left >= right;
   return (cond_typ >> (gt + ge)) & 1;
 };
+#endif
 
 DECL_VM_HANDLE(cjmp) {
-  int left = stack->top[-1];
+  int left = stack->tos;
   int right = stack->top[0];
 
-  return do_cmp(dat.cjmp.cmp_typ, left, right) ? dat.cjmp.offset : 1;
+  return do_cmp(op.slot, left, right) ? op.imm : 1;
+}
+
+// In-place compares, `jmp` is the word after `op`
+#define DECL_VM_HANDLE2(x) int x(CyrVM *vm, OpCode op, OpCode jmp)
+
+static int cjmp_to(OpCode op, OpCode jmp, int left, int right) {
+  return do_cmp(CJMP_SLOT_CMP(op.slot), left, right) ? 1 + jmp.imm : 2;
+}
+
+DECL_VM_HANDLE2(cjmp_vi) {
+  return cjmp_to(op, jmp, *int_ref(vm, CJMP_SLOT_DECL(op.slot)), op.imm);
+}
+
+DECL_VM_HANDLE2(cjmp_vv) {
+  int left = *int_ref(vm, CJMP_SLOT_DECL(op.slot));
+  return cjmp_to(op, jmp, left, *int_ref(vm, op.imm));
+}
+
+
+DECL_VM_HANDLE2(cjmp_ai) {
+  VarDecl *decl = decl_ref(vm, CJMP_SLOT_DECL(op.slot));
+  int left = load_elem(decl, *int_ref(vm, jmp.slot));
+  return cjmp_to(op, jmp, left, op.imm);
 }
 
 // short cmp(Stack *stack, union OpCodeData dat) {
@@ -135,19 +251,40 @@ DECL_VM_HANDLE(cjmp) {
 //   return 1;
 // }
 
+// The stack is empty after it, as after CJMP
+DECL_VM_HANDLE(for_init) {
+  int start = stack->top[0];
+  int end = stack->tos;
+  if (start > end) {
+    return op.imm;
+  }
+  *int_ref(vm, op.slot) = start;
+  vm->for_ends[op.slot] = end;
+  return 1;
+}
+
+// Stops on reaching the end, so an end of INT_MAX doesn't wrap
+DECL_VM_HANDLE(for_next) {
+  int *var = int_ref(vm, op.slot);
+  if (*var == vm->for_ends[op.slot]) {
+    return 1;
+  }
+  *var = (unsigned)*var + 1;
+  return op.imm;
+}
+
 DECL_VM_HANDLE(incr) {
-  stack->top[1] += dat.constant;
+  stack->tos += op.imm;
   return 1;
 }
 
 DECL_VM_HANDLE(inci) {
-  // *int_ref(vm, dat.var_const.decl_idx) += dat.var_const.constant;
-  *int_ref(dat.var_const.ptr) += dat.var_const.constant;
+  *int_ref(vm, op.slot) += op.imm;
   return 1;
 }
 
 DECL_VM_HANDLE(binadd) {
-  stack->top[1] += stack->top[0];
+  stack->tos += stack->top[1];
   return 1;
 }
 
@@ -172,16 +309,124 @@ DECL_VM_HANDLE(binadd) {
 // }
 
 DECL_VM_HANDLE(cmul) {
-  stack->top[1] *= dat.constant;
+  stack->tos *= op.imm;
+  return 1;
+}
+
+// The terms are gathered from separate decls, a plain loop is all it takes
+static int eval_lincomb(CyrVM *vm, OpCode op) {
+  LinTerm *term = vm->lin_terms + op.slot;
+  unsigned cnts = term->decl;
+  int sum = op.imm;
+  for (unsigned i = 1; i <= cnts; i++) {
+    sum += term[i].coef * *int_ref(vm, term[i].decl);
+  }
+  return sum;
+}
+
+DECL_VM_HANDLE(lincomb) {
+  SPILL_TOS();
+  stack->tos = eval_lincomb(vm, op);
+  return 1;
+}
+
+DECL_VM_HANDLE(lincomb_e) {
+  stack->tos = eval_lincomb(vm, op);
   return 1;
 }
 
 DECL_VM_HANDLE(empty_func) { return 1; }
 
 DECL_VM_HANDLE(put) {
-  printf("%d ", stack->top[0]);
+  print_num(stack->tos);
+  return 1;
+}
+
+// First of the `cnts` elements a bulk kernel touches
+static int *bulk_arr_ref(VarDecl *decl, int idx, usize cnts) {
+#ifdef CHECKED
+  bounds_check_range(decl, idx, cnts);
+#endif
+  return arr_ref(decl, idx);
+}
+
+// [start, end, dst_off, ...] were pushed in order, the last one is the
+// cached top
+#define BULK_ARG(n) (stack->top[-(n)])
+#define BULK_CNTS ((unsigned)BULK_ARG(1) - (unsigned)BULK_ARG(0) + 1)
+
+DECL_VM_HANDLE(fill) {
+  int start = BULK_ARG(0);
+  if (start <= BULK_ARG(1)) {
+    bulk_fill(
+        bulk_arr_ref(decl_ref(vm, op.slot), start + BULK_ARG(2), BULK_CNTS),
+        BULK_CNTS, stack->tos);
+  }
+  return 1;
+}
+
+DECL_VM_HANDLE(iota) {
+  int start = BULK_ARG(0);
+  int stride = op.imm;
+  if (start <= BULK_ARG(1)) {
+    bulk_iota(
+        bulk_arr_ref(decl_ref(vm, op.slot), start + BULK_ARG(2), BULK_CNTS),
+        BULK_CNTS, (unsigned)stride * start + stack->tos, stride);
+  }
+  return 1;
+}
+
+DECL_VM_HANDLE(copy) {
+  int start = BULK_ARG(0);
+  VarDecl *src = decl_ref(vm, op.imm);
+  if (start <= BULK_ARG(1)) {
+    bulk_copy(
+        bulk_arr_ref(decl_ref(vm, op.slot), start + BULK_ARG(2), BULK_CNTS),
+        bulk_arr_ref(src, start + BULK_ARG(3), BULK_CNTS), BULK_CNTS,
+        stack->tos);
+  }
+  return 1;
+}
+
+// [start, end, x] -> push(result)
+DECL_VM_HANDLE(suma) {
+  int start = stack->top[1];
+  int sum = 0;
+  if (start <= stack->top[0]) {
+    usize cnts = (unsigned)stack->top[0] - (unsigned)start + 1;
+    sum = bulk_sum(
+        bulk_arr_ref(decl_ref(vm, op.slot), start + stack->tos, cnts), cnts);
+  }
+  stack->tos = (unsigned)op.imm * sum;
+  return 1;
+}
+
+DECL_VM_HANDLE(series) {
+  int start = stack->top[1];
+  int sum = 0;
+  if (start <= stack->top[0]) {
+    sum = bulk_series_sum(start, (unsigned)stack->top[0] - (unsigned)start + 1,
+                          op.imm, stack->tos);
+  }
+  stack->tos = sum;
+  return 1;
+}
+
+#ifdef CHECKED
+DECL_VM_HANDLE(check) {
+  bounds_check(decl_ref(vm, op.slot), stack->tos);
+  return 1;
+}
+
+DECL_VM_HANDLE(bounds) {
+  int start = BULK_ARG(0);
+  int end = BULK_ARG(1);
+  if (start <= end) {
+    bounds_check_hoist(decl_ref(vm, op.slot), op.imm, start, end, stack->tos);
+  }
   return 1;
 }
+#endif
 
 // static vm_handler handlers[] = {
 //     [OP_LOAD_CONST] = load_const,
@@ -205,14 +450,28 @@ DECL_VM_HANDLE(put) {
 
 #define ST_PO(x) (0 + (x))
 
-static int stack_deltas[] = {
+static const int stack_deltas[] = {
     [OP_LOAD_CONST] = ST_PO(-1), [OP_LOAD_INT] = ST_PO(-1),
     [OP_LOAD_ARR] = ST_PO(0),    [OP_STORE_INT] = ST_PO(1),
     [OP_STORE_ARR] = ST_PO(2),   [OP_SETI] = ST_PO(0),
+    [OP_LOAD_ARR16] = ST_PO(0),  [OP_LOAD_ARR8] = ST_PO(0),
+    [OP_STORE_ARR16] = ST_PO(2), [OP_STORE_ARR8] = ST_PO(2),
+    [OP_LOAD_CONST_E] = ST_PO(-1), [OP_LOAD_INT_E] = ST_PO(-1),
     [OP_INCR] = ST_PO(0),        [OP_INCI] = ST_PO(0),
+    [OP_INCA] = ST_PO(1),        [OP_ADDA] = ST_PO(2),
+    [OP_SETA] = ST_PO(1),
     [OP_CMUL] = ST_PO(0),        [OP_BINADD] = ST_PO(1),
+    [OP_LINCOMB] = ST_PO(-1),    [OP_LINCOMB_E] = ST_PO(-1),
     [OP_PUT] = ST_PO(1),         [OP_JMP] = ST_PO(0),
-    [OP_CJMP] = ST_PO(2),        [OP_HALT] = ST_PO(0),
+    [OP_CJMP] = ST_PO(2),        [OP_SWITCH] = ST_PO(1),
+    [OP_CJMP_VI] = ST_PO(0),     [OP_CJMP_VV] = ST_PO(0),
+    [OP_CJMP_AI] = ST_PO(0),
+    [OP_HALT] = ST_PO(0),
+    [OP_FOR_INIT] = ST_PO(2),    [OP_FOR_NEXT] = ST_PO(0),
+    [OP_FILL] = ST_PO(4),        [OP_IOTA] = ST_PO(4),
+    [OP_COPY] = ST_PO(5),        [OP_SUMA] = ST_PO(2),
+    [OP_SERIES] = ST_PO(2),
+    [OP_CHECK] = ST_PO(0),       [OP_BOUNDS] = ST_PO(3),
     // [OP_TRIADD] = ST_PO(2),      [OP_QUADADD] = ST_PO(3),
     // [OP_ADDS] = ST_PO(0),
 };
@@ -222,83 +481,237 @@ int get_stack_delta(enum OpCodeType typ) {
 }
 
 // short bad_commands(CyrVM *vm, Stack *stack, enum OpCodeType typ,
-//                    union OpCodeData dat) {
-//   return handlers[typ](vm, stack, dat);
+//                    OpCode op) {
+//   return handlers[typ](vm, stack, op);
 // }
 
+#ifndef NO_DEBUG
+#define VM_TRACE()                                                             \
+  cnts++;                                                                      \
+  printf("%s\n", op_code_type(op_ptr->typ))
+#else
+#define VM_TRACE()
+#endif
+
+// Each handler moves `top` by the delta of its own opcode, a constant
+#ifdef VM_THREADED
+#define VM_CASE(op)                                                            \
+  do_##op:                                                                     \
+  stack.top += stack_deltas[op];
+#define VM_DISPATCH()                                                          \
+  VM_TRACE();                                                                  \
+  goto **label
+#define VM_NEXT(n)                                                             \
+  do {                                                                         \
+    int off = (n);                                                             \
+    op_ptr += off;                                                             \
+    label += off;                                                              \
+    VM_DISPATCH();                                                             \
+  } while (0)
+#else
+#define VM_CASE(op)                                                            \
+  case op:                                                                     \
+    stack.top += stack_deltas[op];
+#define VM_NEXT(n)                                                             \
+  op_ptr += (n);                                                               \
+  continue
+#endif
+
 void cyr_vm_execute(CyrVM *cyr_vm) {
   Stack stack;
-  stack_init(&stack);
+  stack_init(&stack, cyr_vm->max_depth);
+  usize decl_cnts = cyr_vm->var_decls->item_cnts;
+  cyr_vm->for_ends = malloc((decl_cnts ? decl_cnts : 1) * sizeof(int));
   OpCode *op_ptr = cyr_vm->codes->items;
-  union OpCodeData dat = op_ptr->data;
-  enum OpCodeType typ = op_ptr->typ;
 #ifndef NO_DEBUG
   int cnts = 0;
   // int bad_cnts = 0;
 #endif
+#define EXEC(x) x(cyr_vm, &stack, *op_ptr)
+#define EXEC2(x) x(cyr_vm, op_ptr[0], op_ptr[1])
+#ifdef VM_THREADED
+  static const void *const labels[] = {
+      [OP_LOAD_CONST] = &&do_OP_LOAD_CONST,
+      [OP_LOAD_INT] = &&do_OP_LOAD_INT,
+      [OP_LOAD_ARR] = &&do_OP_LOAD_ARR,
+      [OP_STORE_INT] = &&do_OP_STORE_INT,
+      [OP_STORE_ARR] = &&do_OP_STORE_ARR,
+      [OP_SETI] = &&do_OP_SETI,
+      [OP_LOAD_ARR16] = &&do_OP_LOAD_ARR16,
+      [OP_LOAD_ARR8] = &&do_OP_LOAD_ARR8,
+      [OP_STORE_ARR16] = &&do_OP_STORE_ARR16,
+      [OP_STORE_ARR8] = &&do_OP_STORE_ARR8,
+      [OP_LOAD_CONST_E] = &&do_OP_LOAD_CONST_E,
+      [OP_LOAD_INT_E] = &&do_OP_LOAD_INT_E,
+      [OP_INCR] = &&do_OP_INCR,
+      [OP_INCI] = &&do_OP_INCI,
+      [OP_INCA] = &&do_OP_INCA,
+      [OP_ADDA] = &&do_OP_ADDA,
+      [OP_SETA] = &&do_OP_SETA,
+      [OP_CMUL] = &&do_OP_CMUL,
+      [OP_BINADD] = &&do_OP_BINADD,
+      [OP_LINCOMB] = &&do_OP_LINCOMB,
+      [OP_LINCOMB_E] = &&do_OP_LINCOMB_E,
+      [OP_PUT] = &&do_OP_PUT,
+      [OP_JMP] = &&do_OP_JMP,
+      [OP_CJMP] = &&do_OP_CJMP,
+      [OP_CJMP_VI] = &&do_OP_CJMP_VI,
+      [OP_CJMP_VV] = &&do_OP_CJMP_VV,
+      [OP_CJMP_AI] = &&do_OP_CJMP_AI,
+      [OP_SWITCH] = &&do_OP_SWITCH,
+      [OP_FOR_INIT] = &&do_OP_FOR_INIT,
+      [OP_FOR_NEXT] = &&do_OP_FOR_NEXT,
+      [OP_HALT] = &&do_OP_HALT,
+#ifdef CHECKED
+      [OP_CHECK] = &&do_OP_CHECK,
+      [OP_BOUNDS] = &&do_OP_BOUNDS,
+#endif
+      [OP_FILL] = &&do_OP_FILL,
+      [OP_IOTA] = &&do_OP_IOTA,
+      [OP_COPY] = &&do_OP_COPY,
+      [OP_SUMA] = &&do_OP_SUMA,
+      [OP_SERIES] = &&do_OP_SERIES,
+  };
+  usize code_cnts = cyr_vm->codes->item_cnts;
+  const void **thread = malloc(code_cnts * sizeof(void *));
+  for (usize i = 0; i < code_cnts; i++) {
+    thread[i] = labels[op_ptr[i].typ];
+  }
+  const void **label = thread;
+  VM_DISPATCH();
+#else
   while (1) {
-#ifndef NO_DEBUG
-    cnts++;
-    printf("%s\n", op_code_type(op_ptr->typ));
+    VM_TRACE();
+    switch (op_ptr->typ) {
+#endif
+  VM_CASE(OP_LOAD_CONST)
+    EXEC(load_const);
+    VM_NEXT(1);
+  VM_CASE(OP_LOAD_INT)
+    EXEC(load_int);
+    VM_NEXT(1);
+  VM_CASE(OP_LOAD_CONST_E)
+    EXEC(load_const_e);
+    VM_NEXT(1);
+  VM_CASE(OP_LOAD_INT_E)
+    EXEC(load_int_e);
+    VM_NEXT(1);
+  VM_CASE(OP_LOAD_ARR)
+    EXEC(load_arr);
+    VM_NEXT(1);
+  VM_CASE(OP_STORE_INT)
+    EXEC(store_int);
+    VM_NEXT(1);
+  VM_CASE(OP_STORE_ARR)
+    EXEC(store_arr);
+    VM_NEXT(1);
+  VM_CASE(OP_LOAD_ARR16)
+    EXEC(load_arr16);
+    VM_NEXT(1);
+  VM_CASE(OP_LOAD_ARR8)
+    EXEC(load_arr8);
+    VM_NEXT(1);
+  VM_CASE(OP_STORE_ARR16)
+    EXEC(store_arr16);
+    VM_NEXT(1);
+  VM_CASE(OP_STORE_ARR8)
+    EXEC(store_arr8);
+    VM_NEXT(1);
+  VM_CASE(OP_SETI)
+    EXEC(seti);
+    VM_NEXT(1);
+  VM_CASE(OP_INCR)
+    EXEC(incr);
+    VM_NEXT(1);
+  VM_CASE(OP_INCI)
+    EXEC(inci);
+    VM_NEXT(1);
+  VM_CASE(OP_INCA)
+    EXEC(inca);
+    VM_NEXT(1);
+  VM_CASE(OP_ADDA)
+    EXEC(adda);
+    VM_NEXT(1);
+  VM_CASE(OP_SETA)
+    EXEC(seta);
+    VM_NEXT(1);
+  VM_CASE(OP_CMUL)
+    EXEC(cmul);
+    VM_NEXT(1);
+  VM_CASE(OP_BINADD)
+    EXEC(binadd);
+    VM_NEXT(1);
+  VM_CASE(OP_LINCOMB)
+    EXEC(lincomb);
+    VM_NEXT(1);
+  VM_CASE(OP_LINCOMB_E)
+    EXEC(lincomb_e);
+    VM_NEXT(1);
+  VM_CASE(OP_PUT)
+    EXEC(put);
+    VM_NEXT(1);
+  VM_CASE(OP_FILL)
+    EXEC(fill);
+    VM_NEXT(1);
+  VM_CASE(OP_IOTA)
+    EXEC(iota);
+    VM_NEXT(1);
+  VM_CASE(OP_COPY)
+    EXEC(copy);
+    VM_NEXT(1);
+  VM_CASE(OP_SUMA)
+    EXEC(suma);
+    VM_NEXT(1);
+  VM_CASE(OP_SERIES)
+    EXEC(series);
+    VM_NEXT(1);
+#ifdef CHECKED
+  VM_CASE(OP_CHECK)
+    EXEC(check);
+    VM_NEXT(1);
+  VM_CASE(OP_BOUNDS)
+    EXEC(bounds);
+    VM_NEXT(1);
 #endif
-    typ = op_ptr->typ;
-    dat = op_ptr->data;
-    stack.top += op_ptr->stack_delta;
-#define EXEC(x) x(cyr_vm, &stack, dat)
-    switch (typ) {
-    case OP_LOAD_CONST:
-      EXEC(load_const);
-      break;
-    case OP_LOAD_INT:
-      EXEC(load_int);
-      break;
-    case OP_LOAD_ARR:
-      EXEC(load_arr);
-      break;
-    case OP_STORE_INT:
-      EXEC(store_int);
-      break;
-    case OP_STORE_ARR:
-      EXEC(store_arr);
-      break;
-    case OP_SETI:
-      EXEC(seti);
-      break;
-    case OP_INCR:
-      EXEC(incr);
-      break;
-    case OP_INCI:
-      EXEC(inci);
-      break;
-    case OP_CMUL:
-      EXEC(cmul);
-      break;
-    case OP_BINADD:
-      EXEC(binadd);
-      break;
-    case OP_PUT:
-      EXEC(put);
-      break;
-    case OP_JMP:
-      op_ptr += EXEC(jmp);
-      continue;
-    case OP_CJMP:
-      op_ptr += EXEC(cjmp);
-      continue;
-    case OP_HALT:
+  VM_CASE(OP_JMP)
+    VM_NEXT(EXEC(jmp));
+  VM_CASE(OP_CJMP)
+    VM_NEXT(EXEC(cjmp));
+  VM_CASE(OP_CJMP_VI)
+    VM_NEXT(EXEC2(cjmp_vi));
+  VM_CASE(OP_CJMP_VV)
+    VM_NEXT(EXEC2(cjmp_vv));
+  VM_CASE(OP_CJMP_AI)
+    VM_NEXT(EXEC2(cjmp_ai));
+  VM_CASE(OP_FOR_INIT)
+    VM_NEXT(EXEC(for_init));
+  VM_CASE(OP_FOR_NEXT)
+    VM_NEXT(EXEC(for_next));
+  VM_CASE(OP_SWITCH) {
+    // Take the entry's jump right away
+    int entry = EXEC(switch_idx);
+    VM_NEXT(entry + op_ptr[entry].imm);
+  }
+  VM_CASE(OP_HALT)
 #ifndef NO_DEBUG
-      // printf("\nDispatched bad commands of %d(%d%%)\n", bad_cnts,
-      //        bad_cnts * 100 / cnts);
-      // printf("Dispatched good commands of %d(%d%%)\n", cnts - bad_cnts,
-      //        100 - (bad_cnts * 100 / cnts));
-      printf("Dispatched commands of %d(100%%)\n", cnts);
+    // printf("\nDispatched bad commands of %d(%d%%)\n", bad_cnts,
+    //        bad_cnts * 100 / cnts);
+    // printf("Dispatched good commands of %d(%d%%)\n", cnts - bad_cnts,
+    //        100 - (bad_cnts * 100 / cnts));
+    printf("Dispatched commands of %d(100%%)\n", cnts);
+#endif
+#ifdef VM_THREADED
+    free(thread);
 #endif
-      return;
+    stack_free(&stack);
+    free(cyr_vm->for_ends);
+    return;
+#ifndef VM_THREADED
     default:
       __builtin_unreachable();
     }
-    op_ptr++;
   }
+#endif
 }
 
 #endif
\ No newline at end of file